@@ -6,11 +6,66 @@
 
 #include "ast.hh"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
 #include "miniscript.hh"
 #include "runtime.hh"
+#include "server.hh"
 
 using namespace std;
 
+/* the lexer's line, where we are in parsing */
+extern int yylineno;
+
+int yyparse(std::list<Statement*>* &program);
+/* in the lexer, have it read a lone function body */
+void scanFunctionBody(const FunctionSource* source);
+void endFunctionBody();
+
+void yyerror(std::list<Statement*>* &program, const char * s)
+{
+	fprintf(scriptErr, "%s\n", s);
+	if (!serving)
+		exit(1); /* just end here */
+}
+
+void* Statement::operator new(size_t size)
+{
+	memStats.allocated(MemStats::AST, yylineno, size);
+	return ::operator new(size);
+}
+
+void Statement::operator delete(void* pointer, size_t size)
+{
+	memStats.freed(MemStats::AST, 0, size);
+	::operator delete(pointer);
+}
+
+Expression::~Expression()
+{
+	// an inlined copy given up on mid-way is deleted before it is used
+	if (parsedExpressions)
+	{
+		auto found = std::find(parsedExpressions->begin(), parsedExpressions->end(), this);
+		if (found != parsedExpressions->end())
+			parsedExpressions->erase(found);
+	}
+}
+
+void* Expression::operator new(size_t size)
+{
+	memStats.allocated(MemStats::AST, yylineno, size);
+	return ::operator new(size);
+}
+
+void Expression::operator delete(void* pointer, size_t size)
+{
+	memStats.freed(MemStats::AST, 0, size);
+	::operator delete(pointer);
+}
+
 DocumentWrite::DocumentWrite(std::list<Expression*>* parameters, int lineNumber) :
 	Statement(lineNumber), parameters(parameters)
 {
@@ -65,20 +120,60 @@ Iterator::Iterator(Expression* condition,
 	rdprintf("Iterator: %d\n", lineNumber);
 }
 
-Function::Function(std::string name,
-	std::list<std::string>* func_params,
+Function::Function(const Atom* name,
+	std::list<const Atom*>* func_params,
 	std::list<Statement*>* body,
 	int lineNumber) :
 	Statement(lineNumber), name(name), func_params(func_params), body(body)
 {
 	rdprintf("Function: %d\n", lineNumber);
 	// add this function to the global context
-	shared_ptr<Symbol> newSymbol(new Symbol());
+	Symbol* newSymbol = heap.allocate<Symbol>();
 	newSymbol->type = Symbol::FUNCTION;
 	newSymbol->declared = true;
 	newSymbol->assigned = true;
 	newSymbol->function = this;
-	(*globalContext)[name] = newSymbol;
+	globalContext->insert(name, newSymbol);
+}
+
+Function::Function(const Atom* name,
+	std::list<const Atom*>* func_params,
+	FunctionSource* source,
+	int lineNumber) :
+	Function(name, func_params, (std::list<Statement*>*)NULL, lineNumber)
+{
+	this->source = source;
+	statements = parsedStatements;
+	expressions = parsedExpressions;
+	atoms = atomScope;
+}
+
+void Function::parse()
+{
+	TraceScope traceScope("parse");
+	lock_guard<mutex> lock(parseLock);
+
+	// statements we make belong to whoever parsed us
+	std::vector<Statement*>* outerStatements = parsedStatements;
+	std::vector<Expression*>* outerExpressions = parsedExpressions;
+	AtomScope* outerAtoms = atomScope;
+	parsedStatements = statements;
+	parsedExpressions = expressions;
+	atomScope = atoms;
+	scanFunctionBody(source);
+	std::list<Statement*>* parsed = NULL;
+	int failed = yyparse(parsed);
+	endFunctionBody();
+	parsedStatements = outerStatements;
+	atomScope = outerAtoms;
+
+	// a body with a syntax error does nothing
+	body = (failed || parsed == NULL) ? new std::list<Statement*>() : parsed;
+	delete source;
+	source = NULL;
+
+	inferFunction(this);
+	parsedExpressions = outerExpressions;
 }
 
 Call::Call(Expression* callable, int lineNumber) :
@@ -116,7 +211,7 @@ IntConst::IntConst(int value, int lineNumber) : Constant(lineNumber)
 	symbol.int_value = value;
 }
 
-StringConst::StringConst(std::string value, int lineNumber) : Constant(lineNumber)
+StringConst::StringConst(const Atom* value, int lineNumber) : Constant(lineNumber)
 {
 	symbol.type = Symbol::STRING;
 	symbol.string_value = value;
@@ -133,26 +228,26 @@ BoolConst::BoolConst(bool truth, int lineNumber) : Constant(lineNumber)
 	symbol.bool_value = truth;
 }
 
-Variable::Variable(std::string name, int lineNumber) :
+Variable::Variable(const Atom* name, int lineNumber) :
 	Expression(lineNumber), name(name)
 {
 	rdprintf("Variable: %d\n", lineNumber);
 }
 
-Variable::Variable(std::string name, std::string object_name, int lineNumber) :
+Variable::Variable(const Atom* name, const Atom* object_name, int lineNumber) :
 	Expression(lineNumber), name(name), object_name(object_name)
 {
 	rdprintf("Variable: %d\n", lineNumber);
 }
 
-Variable::Variable(std::string name, Expression* index, int lineNumber) :
+Variable::Variable(const Atom* name, Expression* index, int lineNumber) :
 	Expression(lineNumber), name(name), index(index)
 {
 	rdprintf("Variable: %d\n", lineNumber);
 }
 
-Operation::Operation(OpType opType, Expression* left, Expression* right, int lineNumber) :
-	Expression(lineNumber), opType(opType), left(left), right(right)
+Operation::Operation(OpType opType, Expression* left, Expression* right, int lineNumber, int column) :
+	Expression(lineNumber), opType(opType), left(left), right(right), column(column)
 {
 	rdprintf("Operation: %d\n", lineNumber);
 }
@@ -163,7 +258,7 @@ Negate::Negate(Expression* right, int lineNumber) :
 	rdprintf("Negate: %d\n", lineNumber);
 }
 
-Callable::Callable(std::string name, std::list<Expression*>* parameters, int lineNumber) :
+Callable::Callable(const Atom* name, std::list<Expression*>* parameters, int lineNumber) :
 	Expression(lineNumber), name(name), parameters(parameters)
 {
 	rdprintf("Callable: %d\n", lineNumber);
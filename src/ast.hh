@@ -7,22 +7,261 @@
 #ifndef _AST_H
 #define _AST_H
 
+#include <cstdint>
 #include <string>
 #include <map>
 #include <list>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+
+#include "heap.hh"
+#include "atoms.hh"
+#include "metrics.hh"
 
 class Symbol;
+class Statement;
+class Expression;
 class Function;
+class Return;
+class NativeFunction;
+class MappedFile;
+class TypeEnv;
+class CppEmitter;
+
+/* line of the statement being executed */
+extern thread_local int currentLine;
+/* statements executed so far, our fuel gauge */
+extern thread_local unsigned long statementCount;
+/* when set, every statement parsed is added here */
+extern thread_local std::vector<Statement*>* parsedStatements;
+/* likewise every expression parsed, or copied in while inferring types */
+extern thread_local std::vector<Expression*>* parsedExpressions;
+
+/*
+ * symbol table, lives on the collected heap; an open-addressing
+ * hash table with linear probing keyed by atom, so names compare by
+ * pointer, small tables live inline in the context itself
+ */
+class Context : public HeapObject
+{
+public:
+	static const MemStats::Category CATEGORY = MemStats::CONTEXT;
+
+	struct Entry {
+		const Atom* name = NULL;
+		Symbol* symbol = NULL;     // NULL for a free slot
+	};
 
-typedef std::map<std::string, std::shared_ptr<Symbol>> Context;
-typedef std::shared_ptr<Context> ContextPtr;
-typedef std::vector<std::shared_ptr<Symbol>> Array;
+	class iterator
+	{
+		Entry* entry;
+		Entry* last;
+		void skip() { while (entry != last && !entry->symbol) entry++; }
+	public:
+		iterator(Entry* entry, Entry* last) : entry(entry), last(last) { skip(); }
+		Entry& operator*() const { return *entry; }
+		Entry* operator->() const { return entry; }
+		iterator& operator++() { entry++; skip(); return *this; }
+		bool operator!=(const iterator &other) const { return entry != other.entry; }
+	};
+
+	Context() { metrics.add(Metrics::CONTEXTS); }
+	Context(const Context&) = delete;
+	Context& operator=(const Context&) = delete;
+	~Context()
+	{
+		if (entries != inlineEntries)
+			delete[] entries;
+	}
+
+	/* the symbol for a name, NULL if it is not in here */
+	Symbol* find(const Atom* name) const
+	{
+		for (uint32_t i = name->hash & (capacity - 1); entries[i].symbol; i = (i + 1) & (capacity - 1))
+			if (entries[i].name == name)
+				return entries[i].symbol;
+		return NULL;
+	}
+
+	/* add or replace the symbol for a name */
+	void insert(const Atom* name, Symbol* symbol);
+
+	size_t size() const { return count; }
+	void clear();
+
+	iterator begin() { return iterator(entries, entries + capacity); }
+	iterator end() { return iterator(entries + capacity, entries + capacity); }
+
+	void trace(Heap &heap);
+	size_t heapSize() const { return sizeof(Context); }
+
+private:
+	/* enough for most objects and function locals */
+	static const uint32_t INLINE_ENTRIES = 4;
+
+	Entry inlineEntries[INLINE_ENTRIES];
+	Entry* entries = inlineEntries;
+	uint32_t capacity = INLINE_ENTRIES;    // always a power of two
+	uint32_t count = 0;
+
+	void grow();
+};
+
+typedef Context* ContextPtr;
+typedef std::vector<Symbol*> Array;
+
+/* backing store of a string, never changes once made */
+class StringBuffer : public HeapObject
+{
+public:
+	static const MemStats::Category CATEGORY = MemStats::STRING;
 
-class Symbol
+	const std::string value;
+
+	StringBuffer(const std::string &value) : value(value) {}
+
+	size_t heapSize() const { return sizeof(StringBuffer) + value.capacity(); }
+};
+
+/*
+ * immutable string handle, copying one shares the buffer; literals
+ * point at their atom instead, tagged by the low bit, so two of them
+ * compare by pointer and neither is ever collected
+ */
+class String
+{
+	uintptr_t bits = 0;
+
+	bool isAtom() const { return bits & 1; }
+	const Atom* atom() const { return (const Atom*)(bits & ~(uintptr_t)1); }
+	StringBuffer* buffer() const { return (StringBuffer*)bits; }
+public:
+	String() {}
+	String(const std::string &value) :
+		bits(value.empty() ? 0 : (uintptr_t)heap.allocate<StringBuffer>(value)) {}
+	String(const Atom* value) :
+		bits(value->text.empty() ? 0 : (uintptr_t)value | 1) {}
+
+	const std::string& str() const
+	{
+		static const std::string emptyString;
+		if (!bits)
+			return emptyString;
+		return isAtom() ? atom()->text : buffer()->value;
+	}
+	const char* c_str() const { return str().c_str(); }
+	bool empty() const { return !bits; }
+
+	bool operator==(const String &other) const
+	{
+		if (bits == other.bits)
+			return true;
+		// there is only one atom with any text
+		if (isAtom() && other.isAtom())
+			return false;
+		return str() == other.str();
+	}
+	bool operator!=(const String &other) const { return !(*this == other); }
+	String operator+(const String &other) const
+	{
+		if (!other.bits)
+			return *this;
+		if (!bits)
+			return other;
+		return String(str() + other.str());
+	}
+
+	void trace(Heap &heap) const
+	{
+		if (!isAtom())
+			heap.mark(buffer());
+	}
+};
+
+/*
+ * array cells, shared between symbols until one of them writes
+ *
+ * Cells are normally a vector with every index up to the last one
+ * written, those never written being unassigned cells. Writing far
+ * enough past the end that most of it would be gaps switches to a
+ * hash of just the cells there are, and filling back in switches
+ * back, so a few cells at large indexes cost only those few.
+ *
+ * Integers loaded from a file are left packed where the file is mapped
+ * and read from there, only getting cells of their own once one of
+ * them is wanted.
+ */
+class ArrayBuffer : public HeapObject
 {
+	Array cells;
+	std::unordered_map<uint32_t, Symbol*> sparseCells;
+	size_t sparseLength = 0;
+	bool isSparse = false;
+	/* integers kept mapped by mapping, in place of any cells */
+	std::shared_ptr<const MappedFile> mapping;
+	const int32_t* packed = NULL;
+	size_t packedLength = 0;
+
+	Symbol*& slot(size_t index);
+	void makeSparse();
+	void makeDense();
 public:
+	static const MemStats::Category CATEGORY = MemStats::ARRAY;
+
+	bool shared = false;
+
+	bool sparse() const { return isSparse; }
+	/* one past the last index written */
+	size_t size() const { return packed ? packedLength : isSparse ? sparseLength : cells.size(); }
+
+	/* hold count integers from a mapped file, no cells made for them */
+	void pack(std::shared_ptr<const MappedFile> mapping, const int32_t* values, size_t count);
+	/* our integers, if we still hold them packed */
+	const int32_t* packedValues() const { return packed; }
+	/* make cells of our packed integers */
+	void unpack();
+
+	/* the cell at an index, NULL if there is none, never grows us */
+	Symbol* find(size_t index)
+	{
+		if (packed)
+			unpack();
+		if (!isSparse)
+			return index < cells.size() ? cells[index] : NULL;
+		auto found = sparseCells.find(index);
+		return found == sparseCells.end() ? NULL : found->second;
+	}
+	/* the cell at an index, making it first if there is none */
+	Symbol* cell(size_t index);
+	/* put a cell at an index, in place of any there */
+	void set(size_t index, Symbol* cell);
+	/* every cell there is and its index, in no order when sparse,
+	 * and none at all while packed */
+	template <class F>
+	void forEach(F f) const
+	{
+		if (isSparse)
+			for (auto &it : sparseCells)
+				f((size_t)it.first, it.second);
+		else
+			for (size_t i = 0; i < cells.size(); i++)
+				f(i, cells[i]);
+	}
+	/* the cells as a vector, making any that are missing */
+	Array& dense();
+	/* the same cells, but ours to write */
+	ArrayBuffer* copy() const;
+
+	void trace(Heap &heap);
+	size_t heapSize() const { return sizeof(ArrayBuffer); }
+};
+
+class Symbol : public HeapObject
+{
+public:
+	static const MemStats::Category CATEGORY = MemStats::SYMBOL;
+
 	enum Type {
 		STRING,
 		INTEGER,
@@ -31,6 +270,7 @@ public:
 		OBJECT,
 		ARRAY,
 		FUNCTION,
+		NATIVE,
 		UNDEFINED
 	} type;
 
@@ -38,11 +278,12 @@ public:
 	bool assigned;
 
 	int int_value;
-	std::string string_value;
+	String string_value;
 	bool bool_value;
 	ContextPtr object;
-	Array array;
+	ArrayBuffer* array = NULL;
 	Function* function = NULL;
+	const NativeFunction* native = NULL;
 
 	Symbol() :
 		type(UNDEFINED),
@@ -50,34 +291,109 @@ public:
 		assigned(false),
 		int_value(0),
 		bool_value(false),
-		object(std::make_shared<Context>()) {}
+		object(NULL) {}
+
+	size_t arraySize() const { return array ? array->size() : 0; }
+	/* the cell at an index, NULL if there is none */
+	Symbol* arrayCell(size_t index) const { return array ? array->find(index) : NULL; }
+	/* array cells we may write to, copying them first if shared */
+	ArrayBuffer* writableBuffer();
+	/* the same as one vector, with a cell at every index */
+	Array& writableArray() { return writableBuffer()->dense(); }
+	/* we are being stored next to the symbol we were copied from */
+	void share() { if (array) array->shared = true; }
+
+	void trace(Heap &heap)
+	{
+		string_value.trace(heap);
+		heap.mark(object);
+		heap.mark(array);
+	}
+	size_t heapSize() const { return sizeof(Symbol); }
 };
 
+inline void Context::trace(Heap &heap)
+{
+	for (auto &it : *this)
+		heap.mark(it.symbol);
+}
+
+inline void ArrayBuffer::trace(Heap &heap)
+{
+	forEach([&heap](size_t, Symbol* cell) { heap.mark(cell); });
+}
+
 class Statement
 {
 public:
 	int lineNumber;
 	bool errorReported;
 
-	Statement(int lineNumber) : lineNumber(lineNumber), errorReported(false) {};
+	Statement(int lineNumber) : lineNumber(lineNumber), errorReported(false)
+	{
+		if (parsedStatements)
+			parsedStatements->push_back(this);
+	};
 	virtual ~Statement() {};
 
+	/* AST nodes are accounted to the line being parsed */
+	static void* operator new(size_t size);
+	static void operator delete(void* pointer, size_t size);
+
+	/* what starting any statement does, that one becomes the current line */
+	static void enter(int lineNumber)
+	{
+		currentLine = lineNumber;
+		statementCount++;
+		metrics.add(Metrics::STATEMENTS);
+	}
+
+	/* execute this statement as the current line */
+	void run(ContextPtr context)
+	{
+		enter(lineNumber);
+		execute(context);
+	}
+
 	/* execute this statment */
 	virtual void execute(ContextPtr context) = 0;
+	/* static type inference, see infer.cc */
+	virtual void infer(TypeEnv &env) = 0;
+	/* C++ source doing what execute does, see emitcpp.cc */
+	virtual void emit(CppEmitter &out) = 0;
 };
 
-class Expression
+class Expression : public HeapRoot
 {
 public:
 	int lineNumber;
 	/* Local symbol for runtime info */
 	Symbol symbol;
+	/* type our value is proven to have, UNDEFINED if not known */
+	Symbol::Type provenType = Symbol::UNDEFINED;
+
+	Expression(int lineNumber) : lineNumber(lineNumber)
+	{
+		if (parsedExpressions)
+			parsedExpressions->push_back(this);
+	};
+	virtual ~Expression();
 
-	Expression(int lineNumber) : lineNumber(lineNumber) {};
-	virtual ~Expression() { };
+	static void* operator new(size_t size);
+	static void operator delete(void* pointer, size_t size);
+
+	/* our local symbol keeps what it references alive */
+	void trace(Heap &heap) { symbol.trace(heap); }
 
 	/* evaluate this expression */
 	virtual void evaluate(ContextPtr context, bool &errorReported) = 0;
+	/* static type inference, returns provenType */
+	virtual Symbol::Type infer(TypeEnv &env) = 0;
+	/* C++ source making this node for the compiled program to keep
+	 * its symbol in, returns the variable it is kept in */
+	virtual std::string emitNode(CppEmitter &out) = 0;
+	/* C++ source doing what evaluate does */
+	virtual void emitEvaluate(CppEmitter &out, const std::string &errorReported) = 0;
 };
 
 class DocumentWrite : public Statement
@@ -96,6 +412,8 @@ public:
 	}
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Declaration : public Statement
@@ -129,6 +447,8 @@ public:
 	}
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Assignment : public Statement
@@ -147,6 +467,8 @@ public:
 	}
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Conditional : public Statement
@@ -177,6 +499,8 @@ public:
 	}
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Iterator : public Statement
@@ -202,6 +526,8 @@ public:
 	}
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Nop : public Statement
@@ -210,18 +536,39 @@ public:
 	Nop(int lineNumber) : Statement(lineNumber) {};
 
 	void execute(ContextPtr context) {}
+	void infer(TypeEnv &env) {}
+	void emit(CppEmitter &out) {}
+};
+
+/* text of a function body skipped by the lexer, from after its '{' */
+struct FunctionSource
+{
+	std::string text;
+	int lineNumber;
+	int column;
 };
 
 class Function : public Statement
 {
-	std::string name;
-	std::list<std::string>* func_params = NULL;
+	const Atom* name;
+	std::list<const Atom*>* func_params = NULL;
 	std::list<Statement*>* body = NULL;
+	/* a body not parsed until our first call */
+	FunctionSource* source = NULL;
+	std::vector<Statement*>* statements = NULL;   // parsedStatements when we were
+	std::vector<Expression*>* expressions = NULL; // parsedExpressions when we were
+	AtomScope* atoms = NULL;                      // atomScope when we were
+
+	void parse();
 public:
-	Function(std::string name,
-		std::list<std::string>* func_params,
+	Function(const Atom* name,
+		std::list<const Atom*>* func_params,
 		std::list<Statement*>* body,
 		int lineNumber);
+	Function(const Atom* name,
+		std::list<const Atom*>* func_params,
+		FunctionSource* source,
+		int lineNumber);
 
 	~Function()
 	{
@@ -232,11 +579,26 @@ public:
 			for (auto &it : *body) delete it;
 			delete body;
 		}
+		delete source;
 	}
 
 	unsigned int getNumberOfArgs() { return func_params->size(); }
+	const std::string& getName() const { return name->text; }
+	const std::list<const Atom*>* getParams() const { return func_params; }
+	/* our lone statement, if all we do is return something, see inline.cc */
+	Return* onlyReturn() const;
+
+	/* our body compiled ahead of time, run in place of the
+	 * statements, see emitcpp.cc */
+	void (*compiled)(ContextPtr context) = NULL;
+	/* times we have been called, for the next run's type profile */
+	unsigned long calls = 0;
+	/* parse a body left for later now, rather than on our first call */
+	void parseNow() { if (source) parse(); }
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Call : public Statement
@@ -252,6 +614,8 @@ public:
 	}
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Break : public Statement
@@ -260,6 +624,8 @@ public:
 	Break(int lineNumber);
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Continue : public Statement
@@ -268,6 +634,8 @@ public:
 	Continue(int lineNumber);
 
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Return : public Statement
@@ -282,7 +650,11 @@ public:
 			delete ret;
 	}
 
+	Expression* getValue() const { return ret; }
+
 	void execute(ContextPtr context);
+	void infer(TypeEnv &env);
+	void emit(CppEmitter &out);
 };
 
 class Constant : public Expression
@@ -292,6 +664,9 @@ public:
 
 	/* constants are already final */
 	void evaluate(ContextPtr context, bool &errorReported) { return; }
+	Symbol::Type infer(TypeEnv &env) { return provenType = symbol.type; }
+	std::string emitNode(CppEmitter &out);
+	void emitEvaluate(CppEmitter &out, const std::string &errorReported) {}
 };
 
 class IntConst : public Constant
@@ -303,7 +678,7 @@ public:
 class StringConst : public Constant
 {
 public:
-	StringConst(std::string value, int lineNumber);
+	StringConst(const Atom* value, int lineNumber);
 };
 
 class BRConst : public Constant
@@ -321,13 +696,13 @@ public:
 class Variable : public Expression
 {
 public:
-	std::string name;
-	std::string object_name;
+	const Atom* name;
+	const Atom* object_name = NULL;
 	Expression* index = NULL;
 
-	Variable(std::string name, int lineNumber);
-	Variable(std::string name, std::string object_name, int lineNumber);
-	Variable(std::string name, Expression* index, int lineNumber);
+	Variable(const Atom* name, int lineNumber);
+	Variable(const Atom* name, const Atom* object_name, int lineNumber);
+	Variable(const Atom* name, Expression* index, int lineNumber);
 
 	~Variable()
 	{
@@ -336,6 +711,13 @@ public:
 	}
 
 	void evaluate(ContextPtr context, bool &errorReported);
+	Symbol::Type infer(TypeEnv &env);
+	std::string emitNode(CppEmitter &out);
+	void emitEvaluate(CppEmitter &out, const std::string &errorReported);
+	/* evaluate in two halves, looking up our table symbol, then with
+	 * any index evaluated, copying from it; find returns NULL on error */
+	Symbol* find(ContextPtr context, bool &errorReported);
+	void load(Symbol* tableSymbol, bool &errorReported);
 	void declare(ContextPtr context, bool &errorReported);
 	/* note: expression here is assumed to have been previously evaluated */
 	void assign(ContextPtr context, Expression* expression, bool &errorReported);
@@ -356,7 +738,19 @@ public:
 	Expression* left;
 	Expression* right;
 
-	Operation(OpType opType, Expression* left, Expression* right, int lineNumber);
+	/* of our operator, with lineNumber where we are in the source */
+	int column;
+
+	/* our type-specialized evaluate, if we have been quickened */
+	typedef void (Operation::*QuickEvaluate)(ContextPtr context, bool &errorReported);
+	QuickEvaluate quick = NULL;
+	/* the operand type quick is for */
+	Symbol::Type quickType = Symbol::UNDEFINED;
+	/* after this many failed guards we stay generic */
+	static const unsigned int MAX_DEOPTS = 4;
+	unsigned int deopts = 0;
+
+	Operation(OpType opType, Expression* left, Expression* right, int lineNumber, int column);
 
 	~Operation()
 	{
@@ -367,12 +761,31 @@ public:
 	}
 
 	void evaluate(ContextPtr context, bool &errorReported);
+	Symbol::Type infer(TypeEnv &env);
+	std::string emitNode(CppEmitter &out);
+	void emitEvaluate(CppEmitter &out, const std::string &errorReported);
+	/* specialize for operands of this type, if the operator supports it,
+	 * unchecked when the types have been proven statically */
+	void quicken(Symbol::Type type, bool checked = true);
+	/* type of our result for operands of this type, UNDEFINED if invalid */
+	static Symbol::Type resultType(OpType op, Symbol::Type type);
+
+	template <OpType op, Symbol::Type type, bool checked>
+	void evaluateQuick(ContextPtr context, bool &errorReported);
+	/* with left evaluated, settle && and || without right if we can */
+	bool shortCircuit(bool &errorReported);
+	/* with right evaluated too, the rest of a generic evaluate */
+	void combine(Expression* newLeft, bool &errorReported);
+private:
+	void evaluateGeneric(ContextPtr context, bool &errorReported);
 };
 
 class Negate : public Expression
 {
 public:
 	Expression* right;
+	/* cleared once our operand's type has been proven truthy */
+	bool checked = true;
 
 	Negate(Expression* right, int lineNumber);
 
@@ -383,15 +796,46 @@ public:
 	}
 
 	void evaluate(ContextPtr context, bool &errorReported);
+	Symbol::Type infer(TypeEnv &env);
+	std::string emitNode(CppEmitter &out);
+	void emitEvaluate(CppEmitter &out, const std::string &errorReported);
+	/* with our operand evaluated, the rest of evaluate */
+	void negate(bool &errorReported);
+};
+
+/* a parameter of a function inlined into a call, see inline.cc */
+class InlineArgument : public Expression
+{
+public:
+	/* the call's argument, and its value for the call being made */
+	Expression* argument;
+	const Symbol* value;
+
+	InlineArgument(Expression* argument, const Symbol* value, int lineNumber);
+
+	void evaluate(ContextPtr context, bool &errorReported);
+	Symbol::Type infer(TypeEnv &env) { return provenType = argument->provenType; }
+	/* only ever in a copy made for a call, which we never emit */
+	std::string emitNode(CppEmitter &out) { return "NULL"; }
+	void emitEvaluate(CppEmitter &out, const std::string &errorReported) {}
 };
 
 class Callable : public Expression
 {
 public:
-	std::string name;
+	const Atom* name;
 	std::list<Expression*>* parameters = NULL;
 
-	Callable(std::string name, std::list<Expression*>* parameters, int lineNumber);
+	/* the body of the function we call, if it was small enough to be
+	 * copied in here, run while the name still means that function */
+	Expression* inlined = NULL;
+	Function* inlinedFunction = NULL;
+	Return* inlinedReturn = NULL;
+	unsigned int inlinedSize = 0;
+	/* what the arguments came to, for the inlined body to read */
+	std::vector<Symbol> inlinedValues;
+
+	Callable(const Atom* name, std::list<Expression*>* parameters, int lineNumber);
 
 	~Callable()
 	{
@@ -400,9 +844,31 @@ public:
 			for (auto &it : *parameters) delete it;
 			delete parameters;
 		}
+		if (inlined)
+			delete inlined;
 	}
 
+	void trace(Heap &heap);
 	void evaluate(ContextPtr context, bool &errorReported);
+	Symbol::Type infer(TypeEnv &env);
+	std::string emitNode(CppEmitter &out);
+	void emitEvaluate(CppEmitter &out, const std::string &errorReported);
+	/* copy the body of a function in, at most room nodes of it */
+	bool inlineFunction(Function* function, unsigned int room);
+
+	/* the pieces of evaluate: the table symbol of what we call, NULL
+	 * if we can't call it; a native called with our arguments; and a
+	 * function called with our arguments already on the call stack */
+	Symbol* callee(ContextPtr context, bool &errorReported);
+	void callNative(ContextPtr context, const NativeFunction* native, bool &errorReported);
+	void invoke(Function* function, ContextPtr context);
+
+private:
+	/* set while the inlined body runs, a call back into
+	 * here from inside it makes an ordinary call */
+	bool inlineActive = false;
+
+	void evaluateInlined(ContextPtr context);
 };
 
 #endif // _AST_H
@@ -0,0 +1,73 @@
+/*
+ * CS352 Spring 2015
+ * Atom table for miniscript
+ * Andrew F. Davis
+ */
+
+#include "atoms.hh"
+
+#include <mutex>
+#include <unordered_set>
+
+#include "memstats.hh"
+#include "tracer.hh"
+
+using namespace std;
+
+thread_local AtomScope* atomScope = NULL;
+
+struct AtomHash
+{
+	size_t operator()(const Atom* atom) const { return atom->hash; }
+};
+
+struct AtomEqual
+{
+	bool operator()(const Atom* a, const Atom* b) const { return a->text == b->text; }
+};
+
+/* shared by every thread, server workers parse one at a time but run at once */
+static mutex atomLock;
+static unordered_set<const Atom*, AtomHash, AtomEqual> atoms;
+
+const Atom* intern(const string &text, int lineNumber)
+{
+	Atom key(text);
+
+	lock_guard<mutex> lock(atomLock);
+	Atom* atom;
+	auto found = atoms.find(&key);
+	if (found != atoms.end())
+		atom = const_cast<Atom*>(*found);
+	else
+	{
+		atom = new Atom(text);
+		atom->lineNumber = lineNumber;
+		atoms.insert(atom);
+		memStats.allocated(MemStats::AST, lineNumber, sizeof(Atom) + text.capacity());
+	}
+
+	if (!atomScope)
+		atom->permanent = true;
+	else if (atomScope->held.insert(atom).second)
+		atom->scopes++;
+	return atom;
+}
+
+AtomScope::~AtomScope()
+{
+	if (atomScope == this)
+		atomScope = NULL;
+
+	lock_guard<mutex> lock(atomLock);
+	for (auto &it : held)
+	{
+		Atom* atom = const_cast<Atom*>(it);
+		// a trace being written still points at the names
+		if (--atom->scopes || atom->permanent || tracer.isEnabled())
+			continue;
+		atoms.erase(atom);
+		memStats.freed(MemStats::AST, atom->lineNumber, sizeof(Atom) + atom->text.capacity());
+		delete atom;
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ * CS352 Spring 2015
+ * Atom table for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _ATOMS_H
+#define _ATOMS_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+/* hash of an identifier, worked out once when it is interned (FNV-1a) */
+inline uint32_t hashName(const std::string &name)
+{
+	uint32_t hash = 2166136261u;
+	for (auto &it : name)
+	{
+		hash ^= (unsigned char)it;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+class AtomScope;
+
+/*
+ * An interned identifier or string literal. There is only ever one
+ * atom with a given text, so two atoms are equal exactly when they are
+ * the same pointer. An atom lives as long as some scope holds it, or
+ * forever if it was ever interned outside of one.
+ */
+class Atom
+{
+	friend class AtomScope;
+	friend const Atom* intern(const std::string &text, int lineNumber);
+
+	unsigned long scopes = 0;  // scopes holding us
+	bool permanent = false;
+	int lineNumber = 0;        // what memory stats charged us to
+public:
+	const std::string text;
+	const uint32_t hash;
+
+	Atom(const std::string &text) : text(text), hash(hashName(text)) {}
+
+	const char* c_str() const { return text.c_str(); }
+};
+
+/*
+ * The atoms one parsed program uses, given back when it goes so that
+ * a server or batch run doesn't keep every name it has ever seen.
+ */
+class AtomScope
+{
+	friend const Atom* intern(const std::string &text, int lineNumber);
+
+	std::unordered_set<const Atom*> held;
+public:
+	AtomScope() {}
+	AtomScope(const AtomScope&) = delete;
+	AtomScope& operator=(const AtomScope&) = delete;
+	~AtomScope();
+};
+
+/* the scope new atoms are held by on this thread, NULL to keep them forever */
+extern thread_local AtomScope* atomScope;
+
+/* the atom for this text, made the first time it is asked for; the
+ * line is what memory stats charge it to, zero if it isn't the parser's */
+const Atom* intern(const std::string &text, int lineNumber = 0);
+
+#endif // _ATOMS_H
@@ -0,0 +1,630 @@
+/*
+ * CS352 Spring 2015
+ * Batch runner for miniscript
+ * Andrew F. Davis
+ */
+
+#include "batch.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cctype>
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "program.hh"
+#include "server.hh"
+
+using namespace std;
+
+/* records read ahead of the oldest one still running, per worker */
+static const size_t WINDOW_PER_WORKER = 4;
+
+/* one line of input and what running the script on it printed */
+struct Record
+{
+	unsigned long number;
+	string text;
+	string out;
+	string err;
+	bool bad = false;
+	bool done = false;
+};
+
+static mutex batchLock;
+/* workers wait here for records, the reader for them to finish */
+static condition_variable recordReady;
+static condition_variable recordDone;
+/* records not yet picked up by a worker */
+static deque<Record*> pending;
+/* every record not yet written out, oldest first */
+static deque<Record*> inOrder;
+static bool endOfRecords = false;
+
+static string batchScript;
+static Limits batchLimits;
+
+/* the main thread's collector settings, for each worker's heap */
+static size_t heapThreshold;
+static double heapGrowth;
+static long heapPauseBudget;
+
+/*
+ * Turns a record into globals. Miniscript values are integers,
+ * strings and booleans, objects and arrays of those, so that is
+ * all a record may hold.
+ */
+class RecordParser
+{
+	const string &text;
+	size_t pos = 0;
+public:
+	string error;
+
+	RecordParser(const string &text) : text(text) {}
+
+	bool parse();
+
+private:
+	void skipSpace()
+	{
+		while (pos < text.size() && isspace((unsigned char)text[pos]))
+			pos++;
+	}
+	bool atEnd()
+	{
+		skipSpace();
+		return pos == text.size();
+	}
+	bool expect(char c)
+	{
+		skipSpace();
+		if (pos < text.size() && text[pos] == c)
+		{
+			pos++;
+			return true;
+		}
+		error = string("expected '") + c + "'";
+		return false;
+	}
+
+	bool parseJSON();
+	bool parsePairs();
+	bool parseName(string &name);
+	bool parseString(string &value);
+	bool parseInteger(int &value);
+	bool parseValue(Symbol* symbol, bool nested);
+	bool parseBare(Symbol* symbol);
+};
+
+static bool isName(const string &name)
+{
+	if (name.empty() || !isalpha((unsigned char)name[0]))
+		return false;
+	for (auto c : name)
+		if (!isalnum((unsigned char)c) && c != '_')
+			return false;
+	return true;
+}
+
+/* a fresh global, replacing whatever had the name before */
+static Symbol* newGlobal(const string &name)
+{
+	Symbol* symbol = heap.allocate<Symbol>();
+	symbol->declared = true;
+	globalContext->insert(intern(name), symbol);
+	return symbol;
+}
+
+bool RecordParser::parse()
+{
+	skipSpace();
+	if (pos < text.size() && text[pos] == '{')
+		return parseJSON();
+	return parsePairs();
+}
+
+bool RecordParser::parseJSON()
+{
+	pos++;
+	if (!atEnd() && text[pos] == '}')
+		pos++;
+	else
+		for (;;)
+		{
+			string name;
+			if (!parseName(name) || !expect(':'))
+				return false;
+			if (!parseValue(newGlobal(name), false))
+				return false;
+			if (atEnd())
+			{
+				error = "expected '}'";
+				return false;
+			}
+			if (text[pos++] == '}')
+				break;
+			if (text[pos - 1] != ',')
+			{
+				error = "expected ',' or '}'";
+				return false;
+			}
+		}
+	if (!atEnd())
+	{
+		error = "text after the record";
+		return false;
+	}
+	return true;
+}
+
+bool RecordParser::parsePairs()
+{
+	while (!atEnd())
+	{
+		size_t equals = text.find('=', pos);
+		if (equals == string::npos)
+		{
+			error = "expected key=value";
+			return false;
+		}
+		string name = text.substr(pos, equals - pos);
+		if (!isName(name))
+		{
+			error = "\"" + name + "\" is not a variable name";
+			return false;
+		}
+		pos = equals + 1;
+		if (!parseBare(newGlobal(name)))
+			return false;
+	}
+	return true;
+}
+
+bool RecordParser::parseName(string &name)
+{
+	if (!parseString(name))
+		return false;
+	if (!isName(name))
+	{
+		error = "\"" + name + "\" is not a variable name";
+		return false;
+	}
+	return true;
+}
+
+bool RecordParser::parseString(string &value)
+{
+	if (!expect('"'))
+		return false;
+	value.clear();
+	while (pos < text.size() && text[pos] != '"')
+	{
+		char c = text[pos++];
+		if (c != '\\')
+		{
+			value += c;
+			continue;
+		}
+		if (pos == text.size())
+			break;
+		switch (c = text[pos++])
+		{
+			case 'b': value += '\b'; break;
+			case 'f': value += '\f'; break;
+			case 'n': value += '\n'; break;
+			case 'r': value += '\r'; break;
+			case 't': value += '\t'; break;
+			case 'u':
+			{
+				if (pos + 4 > text.size())
+				{
+					error = "bad \\u escape";
+					return false;
+				}
+				char* end;
+				string digits = text.substr(pos, 4);
+				unsigned long code = strtoul(digits.c_str(), &end, 16);
+				if (*end)
+				{
+					error = "bad \\u escape";
+					return false;
+				}
+				pos += 4;
+				// as UTF-8, surrogate pairs are not worth the trouble
+				if (code < 0x80)
+					value += (char)code;
+				else if (code < 0x800)
+				{
+					value += (char)(0xc0 | (code >> 6));
+					value += (char)(0x80 | (code & 0x3f));
+				}
+				else
+				{
+					value += (char)(0xe0 | (code >> 12));
+					value += (char)(0x80 | ((code >> 6) & 0x3f));
+					value += (char)(0x80 | (code & 0x3f));
+				}
+				break;
+			}
+			default: value += c; break;  // \" \\ and \/
+		}
+	}
+	if (pos == text.size())
+	{
+		error = "unterminated string";
+		return false;
+	}
+	pos++;
+	return true;
+}
+
+bool RecordParser::parseInteger(int &value)
+{
+	size_t start = pos;
+	if (pos < text.size() && text[pos] == '-')
+		pos++;
+	while (pos < text.size() && isdigit((unsigned char)text[pos]))
+		pos++;
+	if (pos < text.size() && (text[pos] == '.' || text[pos] == 'e' || text[pos] == 'E'))
+	{
+		error = "numbers must be integers";
+		return false;
+	}
+	string digits = text.substr(start, pos - start);
+	if (digits.empty() || digits == "-")
+	{
+		error = "expected a number";
+		return false;
+	}
+	errno = 0;
+	long parsed = strtol(digits.c_str(), NULL, 10);
+	if (errno || parsed < INT_MIN || parsed > INT_MAX)
+	{
+		error = digits + " is out of range";
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+bool RecordParser::parseValue(Symbol* symbol, bool nested)
+{
+	skipSpace();
+	if (pos == text.size())
+	{
+		error = "expected a value";
+		return false;
+	}
+
+	char c = text[pos];
+	if (c == '"')
+	{
+		string value;
+		if (!parseString(value))
+			return false;
+		symbol->type = Symbol::STRING;
+		symbol->string_value = String(value);
+	}
+	else if (c == '-' || isdigit((unsigned char)c))
+	{
+		if (!parseInteger(symbol->int_value))
+			return false;
+		symbol->type = Symbol::INTEGER;
+	}
+	else if (!text.compare(pos, 4, "true") || !text.compare(pos, 5, "false"))
+	{
+		symbol->type = Symbol::BOOLEAN;
+		symbol->bool_value = text[pos] == 't';
+		pos += symbol->bool_value ? 4 : 5;
+	}
+	else if (!text.compare(pos, 4, "null"))
+	{
+		// declared but never given a value
+		pos += 4;
+		return true;
+	}
+	else if ((c == '[' || c == '{') && nested)
+	{
+		error = "arrays and objects cannot hold arrays or objects";
+		return false;
+	}
+	else if (c == '[')
+	{
+		pos++;
+		symbol->type = Symbol::ARRAY;
+		Array &cells = symbol->writableArray();
+		if (!atEnd() && text[pos] == ']')
+			pos++;
+		else
+			for (;;)
+			{
+				Symbol* cell = heap.allocateAs<Symbol>(MemStats::ARRAY);
+				cell->declared = true;
+				cells.push_back(cell);
+				if (!parseValue(cell, true))
+					return false;
+				if (atEnd())
+				{
+					error = "expected ']'";
+					return false;
+				}
+				if (text[pos++] == ']')
+					break;
+				if (text[pos - 1] != ',')
+				{
+					error = "expected ',' or ']'";
+					return false;
+				}
+			}
+	}
+	else if (c == '{')
+	{
+		pos++;
+		symbol->type = Symbol::OBJECT;
+		symbol->object = heap.allocate<Context>();
+		if (!atEnd() && text[pos] == '}')
+			pos++;
+		else
+			for (;;)
+			{
+				string name;
+				if (!parseName(name) || !expect(':'))
+					return false;
+				Symbol* field = heap.allocate<Symbol>();
+				field->declared = true;
+				symbol->object->insert(intern(name), field);
+				if (!parseValue(field, true))
+					return false;
+				if (atEnd())
+				{
+					error = "expected '}'";
+					return false;
+				}
+				if (text[pos++] == '}')
+					break;
+				if (text[pos - 1] != ',')
+				{
+					error = "expected ',' or '}'";
+					return false;
+				}
+			}
+	}
+	else
+	{
+		error = "expected a value";
+		return false;
+	}
+	symbol->assigned = true;
+	return true;
+}
+
+/* the value of a key=value pair, a quoted string or up to the next space */
+bool RecordParser::parseBare(Symbol* symbol)
+{
+	if (pos < text.size() && text[pos] == '"')
+	{
+		string value;
+		if (!parseString(value))
+			return false;
+		symbol->type = Symbol::STRING;
+		symbol->string_value = String(value);
+		symbol->assigned = true;
+		return true;
+	}
+
+	size_t start = pos;
+	while (pos < text.size() && !isspace((unsigned char)text[pos]))
+		pos++;
+	string value = text.substr(start, pos - start);
+
+	char* end;
+	errno = 0;
+	long parsed = strtol(value.c_str(), &end, 10);
+	if (!value.empty() && !*end && !errno && parsed >= INT_MIN && parsed <= INT_MAX)
+	{
+		symbol->type = Symbol::INTEGER;
+		symbol->int_value = parsed;
+	}
+	else if (value == "true" || value == "false")
+	{
+		symbol->type = Symbol::BOOLEAN;
+		symbol->bool_value = value == "true";
+	}
+	else
+	{
+		symbol->type = Symbol::STRING;
+		symbol->string_value = String(value);
+	}
+	symbol->assigned = true;
+	return true;
+}
+
+/* run our copy of the script over one record, keeping what it prints */
+static void runRecord(Record* record, CachedProgram* cached)
+{
+	char* outData = NULL;
+	char* errData = NULL;
+	size_t outSize = 0;
+	size_t errSize = 0;
+	scriptOut = open_memstream(&outData, &outSize);
+	scriptErr = open_memstream(&errData, &errSize);
+
+	if (!cached)
+	{
+		fprintf(scriptErr, "record %lu: couldn't load the script\n", record->number);
+		record->bad = true;
+	}
+	else
+	{
+		startProgram(cached, batchLimits);
+		RecordParser parser(record->text);
+		if (!parser.parse())
+		{
+			fprintf(scriptErr, "record %lu: %s\n", record->number, parser.error.c_str());
+			record->bad = true;
+		}
+		else
+		{
+			try { record->bad = runProgram(cached->program); }
+			catch (Expression*) {} // a return at the top ends the script
+			catch (...)
+			{
+				// an error nothing in the script caught, it was
+				// reported where it happened and this run is over
+				record->bad = true;
+			}
+		}
+	}
+
+	fclose(scriptOut);
+	fclose(scriptErr);
+	scriptOut = stdout;
+	scriptErr = stderr;
+	record->out.assign(outData, outSize);
+	record->err.assign(errData, errSize);
+	free(outData);
+	free(errData);
+}
+
+/*
+ * Each worker parses a copy of the script of its own, its AST and
+ * the values rooted in it belong to this thread, and runs it on
+ * one record after another, each in a fresh global context.
+ */
+static void worker()
+{
+	heap.threshold = heapThreshold;
+	heap.growth = heapGrowth;
+	heap.pauseBudget = heapPauseBudget;
+
+	CachedProgram* cached = checkoutProgram(batchScript);
+	for (;;)
+	{
+		Record* record;
+		{
+			unique_lock<mutex> lock(batchLock);
+			recordReady.wait(lock, [] { return !pending.empty() || endOfRecords; });
+			if (pending.empty())
+				break;
+			record = pending.front();
+			pending.pop_front();
+		}
+
+		runRecord(record, cached);
+
+		{
+			lock_guard<mutex> lock(batchLock);
+			record->done = true;
+		}
+		recordDone.notify_one();
+	}
+	if (cached)
+		checkinProgram(batchScript, cached);
+}
+
+/* write out the finished records at the front, returns if any were bad */
+static bool writeFinished(unique_lock<mutex> &lock)
+{
+	bool bad = false;
+	while (!inOrder.empty() && inOrder.front()->done)
+	{
+		Record* record = inOrder.front();
+		inOrder.pop_front();
+		lock.unlock();
+		fwrite(record->out.data(), 1, record->out.size(), stdout);
+		fwrite(record->err.data(), 1, record->err.size(), stderr);
+		bad |= record->bad;
+		delete record;
+		lock.lock();
+	}
+	fflush(stdout);
+	return bad;
+}
+
+int runBatch(const char* scriptPath, const char* recordsPath, unsigned int workers, const Limits &limits)
+{
+	batchScript = scriptPath;
+	batchLimits = limits;
+	heapThreshold = heap.threshold;
+	heapGrowth = heap.growth;
+	heapPauseBudget = heap.pauseBudget;
+
+	// find any syntax errors once, before we start on the records
+	CachedProgram* check = checkoutProgram(batchScript);
+	if (!check)
+		return 1;
+	delete check;
+	// a function body with an error must not end the other runs
+	serving = true;
+
+	FILE* records = strcmp(recordsPath, "-") ? fopen(recordsPath, "r") : stdin;
+	if (!records)
+	{
+		fprintf(stderr, "couldn't open %s for reading\n", recordsPath);
+		return 1;
+	}
+
+	if (workers == 0)
+		workers = thread::hardware_concurrency() ? thread::hardware_concurrency() : 4;
+	vector<thread> threads;
+	for (unsigned int i = 0; i < workers; i++)
+		threads.push_back(thread(worker));
+
+	int status = 0;
+	unsigned long number = 0;
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+	while ((length = getline(&line, &capacity, records)) >= 0)
+	{
+		Record* record = new Record;
+		record->text.assign(line, length);
+		size_t first = record->text.find_first_not_of(" \t\r\n");
+		if (first == string::npos)
+		{
+			delete record;
+			continue;
+		}
+		record->number = ++number;
+
+		unique_lock<mutex> lock(batchLock);
+		// don't read further ahead than we have to
+		recordDone.wait(lock, [workers] {
+			return inOrder.size() < workers * WINDOW_PER_WORKER || inOrder.front()->done;
+		});
+		if (writeFinished(lock))
+			status = 1;
+		inOrder.push_back(record);
+		pending.push_back(record);
+		recordReady.notify_one();
+	}
+	free(line);
+	if (records != stdin)
+		fclose(records);
+
+	{
+		unique_lock<mutex> lock(batchLock);
+		endOfRecords = true;
+		recordReady.notify_all();
+		while (!inOrder.empty())
+		{
+			recordDone.wait(lock, [] { return inOrder.front()->done; });
+			if (writeFinished(lock))
+				status = 1;
+		}
+	}
+	for (auto &it : threads)
+		it.join();
+
+	return status;
+}
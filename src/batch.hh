@@ -0,0 +1,22 @@
+/*
+ * CS352 Spring 2015
+ * Batch runner for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "runtime.hh"
+
+/*
+ * Run a script once for every record read from recordsPath ("-" for
+ * stdin), spread over a pool of worker threads. A record is a line,
+ * either a JSON object ({"n": 3, "name": "x", "list": [1, 2]}) or
+ * whitespace separated key=value pairs (n=3 name="x y"), and its
+ * fields become the globals the script starts with. Each run's output
+ * and errors come out in the order the records went in.
+ */
+int runBatch(const char* scriptPath, const char* recordsPath, unsigned int workers, const Limits &limits);
+
+#endif // _BATCH_H
@@ -0,0 +1,445 @@
+/*
+ * CS352 Spring 2015
+ * Native functions for miniscript
+ * Andrew F. Davis
+ */
+
+#include "builtins.hh"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "miniscript.hh"
+#include "runtime.hh"
+#include "datafiles.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+using namespace std;
+
+/*
+ * Integer kernels. Array cells are symbols scattered over the heap, so
+ * we first gather the values into one buffer (checking their types on
+ * the way) and run these over it. Sums wrap like script addition does.
+ */
+struct Kernels
+{
+	int32_t (*sum)(const int32_t* values, size_t count);
+	int32_t (*minimum)(const int32_t* values, size_t count);
+	int32_t (*maximum)(const int32_t* values, size_t count);
+	long (*indexOf)(const int32_t* values, size_t count, int32_t value);
+};
+
+static int32_t sumScalar(const int32_t* values, size_t count)
+{
+	uint32_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+		sum += (uint32_t)values[i];
+	return (int32_t)sum;
+}
+
+static int32_t minimumScalar(const int32_t* values, size_t count)
+{
+	int32_t result = values[0];
+	for (size_t i = 1; i < count; i++)
+		result = min(result, values[i]);
+	return result;
+}
+
+static int32_t maximumScalar(const int32_t* values, size_t count)
+{
+	int32_t result = values[0];
+	for (size_t i = 1; i < count; i++)
+		result = max(result, values[i]);
+	return result;
+}
+
+static long indexOfScalar(const int32_t* values, size_t count, int32_t value)
+{
+	for (size_t i = 0; i < count; i++)
+		if (values[i] == value)
+			return i;
+	return -1;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2")))
+static int32_t sumAVX2(const int32_t* values, size_t count)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i*)(values + i)));
+	int32_t lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	return (int32_t)((uint32_t)sumScalar(lanes, 8) + (uint32_t)sumScalar(values + i, count - i));
+}
+
+__attribute__((target("avx2")))
+static int32_t minimumAVX2(const int32_t* values, size_t count)
+{
+	if (count < 8)
+		return minimumScalar(values, count);
+	__m256i acc = _mm256_loadu_si256((const __m256i*)values);
+	size_t i = 8;
+	for (; i + 8 <= count; i += 8)
+		acc = _mm256_min_epi32(acc, _mm256_loadu_si256((const __m256i*)(values + i)));
+	int32_t lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	int32_t result = minimumScalar(lanes, 8);
+	return (i < count) ? min(result, minimumScalar(values + i, count - i)) : result;
+}
+
+__attribute__((target("avx2")))
+static int32_t maximumAVX2(const int32_t* values, size_t count)
+{
+	if (count < 8)
+		return maximumScalar(values, count);
+	__m256i acc = _mm256_loadu_si256((const __m256i*)values);
+	size_t i = 8;
+	for (; i + 8 <= count; i += 8)
+		acc = _mm256_max_epi32(acc, _mm256_loadu_si256((const __m256i*)(values + i)));
+	int32_t lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	int32_t result = maximumScalar(lanes, 8);
+	return (i < count) ? max(result, maximumScalar(values + i, count - i)) : result;
+}
+
+__attribute__((target("avx2")))
+static long indexOfAVX2(const int32_t* values, size_t count, int32_t value)
+{
+	__m256i needle = _mm256_set1_epi32(value);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i equal = _mm256_cmpeq_epi32(needle, _mm256_loadu_si256((const __m256i*)(values + i)));
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	long found = indexOfScalar(values + i, count - i, value);
+	return (found < 0) ? -1 : (long)i + found;
+}
+
+__attribute__((target("sse2")))
+static int32_t sumSSE2(const int32_t* values, size_t count)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i*)(values + i)));
+	int32_t lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return (int32_t)((uint32_t)sumScalar(lanes, 4) + (uint32_t)sumScalar(values + i, count - i));
+}
+
+__attribute__((target("sse2")))
+static long indexOfSSE2(const int32_t* values, size_t count, int32_t value)
+{
+	__m128i needle = _mm_set1_epi32(value);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i equal = _mm_cmpeq_epi32(needle, _mm_loadu_si128((const __m128i*)(values + i)));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	long found = indexOfScalar(values + i, count - i, value);
+	return (found < 0) ? -1 : (long)i + found;
+}
+#endif
+
+/* the best kernels this machine can run, picked once */
+static const Kernels& kernels()
+{
+	static const Kernels best = [] {
+		Kernels k = { sumScalar, minimumScalar, maximumScalar, indexOfScalar };
+#ifdef HAVE_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+		{
+			k.sum = sumSSE2;
+			k.indexOf = indexOfSSE2;
+		}
+		if (__builtin_cpu_supports("avx2"))
+			k = { sumAVX2, minimumAVX2, maximumAVX2, indexOfAVX2 };
+#endif
+		return k;
+	}();
+	return best;
+}
+
+/* the cells as plain integers, false unless every one is an assigned integer;
+ * packed ones are used where they are, the rest gathered into values */
+static bool gatherIntegers(const Symbol* array, vector<int32_t> &values, const int32_t* &data)
+{
+	// a sparse array always has gaps
+	if (array->type != Symbol::ARRAY || (array->array && array->array->sparse()))
+		return false;
+	if (array->array && array->array->packedValues())
+	{
+		data = array->array->packedValues();
+		return true;
+	}
+	size_t count = array->arraySize();
+	values.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const Symbol* cell = array->arrayCell(i);
+		if (!cell->assigned || cell->type != Symbol::INTEGER)
+			return false;
+		values[i] = cell->int_value;
+	}
+	data = values.data();
+	return true;
+}
+
+void returnInteger(Symbol &result, int value)
+{
+	result.type = Symbol::INTEGER;
+	result.int_value = value;
+}
+
+void returnBoolean(Symbol &result, bool value)
+{
+	result.type = Symbol::BOOLEAN;
+	result.bool_value = value;
+}
+
+void returnString(Symbol &result, const string &value)
+{
+	result.type = Symbol::STRING;
+	result.string_value = String(value);
+}
+
+static bool isPrimitive(const Symbol* symbol)
+{
+	switch (symbol->type)
+	{
+	case Symbol::STRING:
+	case Symbol::INTEGER:
+	case Symbol::BRTAG:
+	case Symbol::BOOLEAN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool sameValue(const Symbol* a, const Symbol* b)
+{
+	if (a->type != b->type)
+		return false;
+	switch (a->type)
+	{
+	case Symbol::STRING:
+		return a->string_value == b->string_value;
+	case Symbol::INTEGER:
+		return a->int_value == b->int_value;
+	case Symbol::BOOLEAN:
+		return a->bool_value == b->bool_value;
+	default:
+		return true;
+	}
+}
+
+static bool nativeLength(Symbol &result, Symbol** args)
+{
+	if (args[0]->type == Symbol::ARRAY)
+		returnInteger(result, args[0]->arraySize());
+	else if (args[0]->type == Symbol::STRING)
+		returnInteger(result, args[0]->string_value.str().size());
+	else
+		return false;
+	return true;
+}
+
+static bool nativeSum(Symbol &result, Symbol** args)
+{
+	vector<int32_t> gathered;
+	const int32_t* values;
+	if (!gatherIntegers(args[0], gathered, values))
+		return false;
+	returnInteger(result, kernels().sum(values, args[0]->arraySize()));
+	return true;
+}
+
+static bool nativeMin(Symbol &result, Symbol** args)
+{
+	vector<int32_t> gathered;
+	const int32_t* values;
+	if (!gatherIntegers(args[0], gathered, values))
+		return false;
+	// an empty array has no minimum, the result is left without a value
+	if (args[0]->arraySize())
+		returnInteger(result, kernels().minimum(values, args[0]->arraySize()));
+	return true;
+}
+
+static bool nativeMax(Symbol &result, Symbol** args)
+{
+	vector<int32_t> gathered;
+	const int32_t* values;
+	if (!gatherIntegers(args[0], gathered, values))
+		return false;
+	if (args[0]->arraySize())
+		returnInteger(result, kernels().maximum(values, args[0]->arraySize()));
+	return true;
+}
+
+static bool nativeIndexOf(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::ARRAY || !isPrimitive(args[1]))
+		return false;
+
+	vector<int32_t> gathered;
+	const int32_t* values;
+	if (args[1]->type == Symbol::INTEGER && gatherIntegers(args[0], gathered, values))
+	{
+		returnInteger(result, kernels().indexOf(values, args[0]->arraySize(), args[1]->int_value));
+		return true;
+	}
+
+	// anything else is compared a cell at a time
+	long first = -1;
+	if (args[0]->array && args[0]->array->sparse())
+	{
+		// only the cells there are, in no order
+		args[0]->array->forEach([&](size_t index, const Symbol* cell) {
+			if ((first < 0 || (long)index < first) && cell->assigned && sameValue(cell, args[1]))
+				first = index;
+		});
+	}
+	else
+		for (size_t i = 0; i < args[0]->arraySize(); i++)
+			if (args[0]->arrayCell(i)->assigned && sameValue(args[0]->arrayCell(i), args[1]))
+			{
+				first = i;
+				break;
+			}
+	returnInteger(result, first);
+	return true;
+}
+
+static bool nativeFill(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::ARRAY || !isPrimitive(args[1]))
+		return false;
+	for (auto &it : args[0]->writableArray())
+	{
+		bool declared = it->declared;
+		*it = *args[1];
+		it->declared = declared;
+		it->assigned = true;
+	}
+	return true;
+}
+
+static bool nativeCopy(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::ARRAY)
+		return false;
+	// cells are copied when either side next writes them
+	result = *args[0];
+	result.share();
+	return true;
+}
+
+static bool nativeSort(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::ARRAY)
+		return false;
+
+	vector<int32_t> values;
+	const int32_t* data;
+	if (gatherIntegers(args[0], values, data))
+	{
+		// packed ones are sorted in a copy, they get cells on writing
+		if (data != values.data())
+			values.assign(data, data + args[0]->arraySize());
+		sort(values.begin(), values.end());
+		Array &cells = args[0]->writableArray();
+		for (size_t i = 0; i < cells.size(); i++)
+			cells[i]->int_value = values[i];
+		return true;
+	}
+
+	// or all strings
+	vector<String> strings;
+	for (size_t i = 0; i < args[0]->arraySize(); i++)
+	{
+		const Symbol* cell = args[0]->arrayCell(i);
+		if (!cell || !cell->assigned || cell->type != Symbol::STRING)
+			return false;
+		strings.push_back(cell->string_value);
+	}
+	stable_sort(strings.begin(), strings.end(),
+		[](const String &a, const String &b) { return a.str() < b.str(); });
+	Array &writable = args[0]->writableArray();
+	for (size_t i = 0; i < writable.size(); i++)
+		writable[i]->string_value = strings[i];
+	return true;
+}
+
+/*
+ * Every native, builtins first. Symbols point at these so they never
+ * move, a deque keeps them where they are as it grows.
+ */
+static deque<NativeFunction>& natives()
+{
+	static deque<NativeFunction> registered = {
+		{ intern("length"), 1, nativeLength },
+		{ intern("sum"), 1, nativeSum },
+		{ intern("min"), 1, nativeMin },
+		{ intern("max"), 1, nativeMax },
+		{ intern("indexOf"), 2, nativeIndexOf },
+		{ intern("fill"), 2, nativeFill },
+		{ intern("copy"), 1, nativeCopy },
+		{ intern("sort"), 1, nativeSort },
+		{ intern("loadInts"), 1, nativeLoadInts },
+		{ intern("loadLines"), 1, nativeLoadLines },
+		{ intern("saveInts"), 2, nativeSaveInts },
+		{ intern("saveLines"), 2, nativeSaveLines },
+	};
+	return registered;
+}
+
+static void installNative(ContextPtr context, const NativeFunction* native)
+{
+	Symbol* symbol = heap.allocate<Symbol>();
+	symbol->type = Symbol::NATIVE;
+	symbol->declared = true;
+	symbol->assigned = true;
+	symbol->native = native;
+	context->insert(native->name, symbol);
+}
+
+void registerNative(const string &name, unsigned int arity, NativeFunction::Call call)
+{
+	natives().push_back({ intern(name), arity, call });
+	// the global context of this thread may already be up
+	installNative(globalContext, &natives().back());
+}
+
+void installNatives(ContextPtr context)
+{
+	// later ones replace earlier ones of the same name
+	for (auto &it : natives())
+		installNative(context, &it);
+}
+
+const NativeFunction* findNative(const string &name)
+{
+	deque<NativeFunction> &all = natives();
+	for (auto it = all.rbegin(); it != all.rend(); ++it)
+		if (it->name->text == name)
+			return &*it;
+	return NULL;
+}
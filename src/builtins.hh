@@ -0,0 +1,49 @@
+/*
+ * CS352 Spring 2015
+ * Native functions for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _BUILTINS_H
+#define _BUILTINS_H
+
+#include <string>
+#include <functional>
+
+#include "ast.hh"
+
+/*
+ * A global function implemented in C++. Callable hands it pointers to
+ * its evaluated arguments, or for an array passed by name to the
+ * array's own symbol, so it can be read and written in place.
+ */
+class NativeFunction
+{
+public:
+	/* fill in result, false if the arguments were the wrong types */
+	typedef std::function<bool(Symbol &result, Symbol** args)> Call;
+
+	const Atom* name;
+	unsigned int arity;
+	Call call;
+};
+
+/*
+ * Makes call a global function taking exactly arity arguments, for
+ * every script run after this, hiding any earlier native of the same
+ * name. A script function of the same name hides it in turn. Register
+ * everything up front, before any other thread starts running scripts.
+ */
+void registerNative(const std::string &name, unsigned int arity, NativeFunction::Call call);
+
+/* for filling in the result of a native */
+void returnInteger(Symbol &result, int value);
+void returnBoolean(Symbol &result, bool value);
+void returnString(Symbol &result, const std::string &value);
+
+/* add every native to a fresh global context */
+void installNatives(ContextPtr context);
+/* NULL if there is no native by this name */
+const NativeFunction* findNative(const std::string &name);
+
+#endif // _BUILTINS_H
@@ -0,0 +1,128 @@
+/*
+ * CS352 Spring 2015
+ * Client for the miniscript server
+ * Andrew F. Davis
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <string>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+static bool readAll(int fd, char* data, size_t length)
+{
+	while (length)
+	{
+		ssize_t count = read(fd, data, length);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+		data += count;
+		length -= count;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const char* data, size_t length)
+{
+	while (length)
+	{
+		ssize_t written = write(fd, data, length);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s socket file [options]\n", argv[0]);
+		fprintf(stderr, "  options are passed on to the server: --max-steps=N, --timeout=MSEC, --max-heap=BYTES\n");
+		return 1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "socket path %s is too long\n", argv[1]);
+		return 1;
+	}
+	strcpy(address.sun_path, argv[1]);
+
+	// the server has its own working directory
+	char path[PATH_MAX];
+	if (!realpath(argv[2], path))
+	{
+		fprintf(stderr, "couldn't open file for reading\n");
+		return 1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	// path, options, then an empty string
+	string request(path, strlen(path) + 1);
+	for (int i = 3; i < argc; i++)
+		request.append(argv[i], strlen(argv[i]) + 1);
+	request.push_back('\0');
+	if (!writeAll(fd, request.data(), request.size()))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	// pass on frames until we get the exit status
+	string data;
+	for (;;)
+	{
+		char header[5];
+		uint32_t length;
+		if (!readAll(fd, header, sizeof(header)))
+			break;
+		memcpy(&length, header + 1, sizeof(length));
+		data.resize(ntohl(length));
+		if (!readAll(fd, &data[0], data.size()))
+			break;
+
+		switch (header[0])
+		{
+		case 'o':
+			fwrite(data.data(), 1, data.size(), stdout);
+			break;
+		case 'e':
+			fflush(stdout);
+			fwrite(data.data(), 1, data.size(), stderr);
+			break;
+		case 'x':
+			fflush(stdout);
+			close(fd);
+			return atoi(data.c_str());
+		}
+	}
+
+	fprintf(stderr, "lost connection to the server\n");
+	return 1;
+}
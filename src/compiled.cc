@@ -0,0 +1,83 @@
+/*
+ * CS352 Spring 2015
+ * Runtime support for compiled miniscript
+ * Andrew F. Davis
+ */
+
+#include "compiled.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "datafiles.hh"
+
+using namespace std;
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [options]\n", name);
+	fprintf(stderr, "  --gc-stats          print garbage collector statistics at exit\n");
+	fprintf(stderr, "  --max-steps=N       stop the script after this many statements\n");
+	fprintf(stderr, "  --timeout=MSEC      stop the script after this much wall-clock time\n");
+	fprintf(stderr, "  --max-heap=BYTES    stop the script if its live heap grows past this\n");
+	fprintf(stderr, "  --data-dir=DIR      where loadInts, loadLines, saveInts and saveLines find their files\n");
+}
+
+int runCompiled(int argc, char* argv[], void (*setup)(), const CompiledStatement* program)
+{
+	bool gcStats = false;
+
+	for (int arg = 1; arg < argc; arg++)
+	{
+		if (!strcmp(argv[arg], "--gc-stats"))
+			gcStats = true;
+		else if (!strncmp(argv[arg], "--max-steps=", 12))
+			limits.fuel = strtoul(argv[arg] + 12, NULL, 0);
+		else if (!strncmp(argv[arg], "--timeout=", 10))
+			limits.timeout = strtol(argv[arg] + 10, NULL, 0);
+		else if (!strncmp(argv[arg], "--max-heap=", 11))
+			limits.heapQuota = strtoul(argv[arg] + 11, NULL, 0);
+		else if (!strncmp(argv[arg], "--data-dir=", 11))
+			dataDirectory = argv[arg] + 11;
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	setup();
+
+	int status = 0;
+	limits.start();
+
+	/* for each Statement in the program */
+	try
+	{
+		for (const CompiledStatement* it = program; it->run; it++)
+		{
+			// nothing but the globals are live between statements
+			safepoint();
+			try { it->run(globalContext); }
+			catch (Statement* s)
+			{
+				// this happens when a break/continue are
+				// used outside of a container
+				fprintf(scriptErr, "Line %d, type violation\n", s->lineNumber);
+			}
+		}
+	}
+	catch (ScriptAbort &abort)
+	{
+		// the script is over, whatever it was doing
+		bool errorReported = false;
+		MS_ERROR::report(errorReported, abort.type, abort.lineNumber);
+		status = 1;
+	}
+
+	if (gcStats)
+		heap.printStats(stderr);
+
+	return status;
+}
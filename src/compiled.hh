@@ -0,0 +1,40 @@
+/*
+ * CS352 Spring 2015
+ * Runtime support for compiled miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _COMPILED_H
+#define _COMPILED_H
+
+#include <list>
+
+#include "ast.hh"
+#include "runtime.hh"
+#include "heap.hh"
+
+/*
+ * A script compiled by --emit-cpp is C++ linked against the same
+ * runtime the interpreter uses. Control flow and operations on proven
+ * types become plain C++, everything else calls into the runtime on
+ * AST nodes the program makes for itself at startup, which also keep
+ * the values expressions leave behind just as the interpreter's do.
+ */
+
+/* a top-level statement of a compiled program */
+struct CompiledStatement
+{
+	int lineNumber;
+	void (*run)(ContextPtr context);
+};
+
+/*
+ * The main of a compiled program: takes the run options the
+ * interpreter does for limits and data files, makes the program's
+ * nodes and functions with setup, then runs its statements in order
+ * as runProgram would, up to the one with no run. Exits 1 if a limit
+ * stopped it.
+ */
+int runCompiled(int argc, char* argv[], void (*setup)(), const CompiledStatement* program);
+
+#endif // _COMPILED_H
@@ -0,0 +1,299 @@
+/*
+ * CS352 Spring 2015
+ * Bulk data files for miniscript
+ * Andrew F. Davis
+ */
+
+#include "datafiles.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <atomic>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "runtime.hh"
+#include "builtins.hh"
+
+using namespace std;
+
+const char* dataDirectory = NULL;
+
+bool MappedFile::map(const string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		close(fd);
+		return false;
+	}
+	size = st.st_size;
+	// there is nothing to map of an empty file
+	if (size == 0)
+	{
+		close(fd);
+		return true;
+	}
+	void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return false;
+	data = (const char*)mapping;
+	return true;
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		munmap((void*)data, size);
+}
+
+/* where a script's path is, false if it isn't allowed one */
+static bool dataPath(const char* native, const Symbol* name, string &path)
+{
+	if (!dataDirectory)
+	{
+		fprintf(scriptErr, "%s: no data directory given (--data-dir)\n", native);
+		return false;
+	}
+	const string &relative = name->string_value.str();
+	// nothing outside the data directory
+	bool escapes = relative.empty() || relative[0] == '/';
+	for (size_t start = 0; !escapes && start <= relative.size();)
+	{
+		size_t end = relative.find('/', start);
+		if (end == string::npos)
+			end = relative.size();
+		escapes = relative.compare(start, end - start, "..") == 0;
+		start = end + 1;
+	}
+	if (escapes)
+	{
+		fprintf(scriptErr, "%s: %s is not in the data directory\n", native, relative.c_str());
+		return false;
+	}
+	path = string(dataDirectory) + "/" + relative;
+	return true;
+}
+
+static shared_ptr<MappedFile> mapData(const char* native, const Symbol* name)
+{
+	string path;
+	if (!dataPath(native, name, path))
+		return NULL;
+	shared_ptr<MappedFile> file = make_shared<MappedFile>();
+	if (!file->map(path))
+	{
+		fprintf(scriptErr, "%s: couldn't read %s: %s\n", native, name->string_value.c_str(), strerror(errno));
+		return NULL;
+	}
+	return file;
+}
+
+/*
+ * Written under a name of its own next to the file and renamed over it,
+ * never truncated in place: the file may be what an array (of this run
+ * or another) is still mapped from, and that mapping has to keep the
+ * old contents.
+ */
+static bool writeData(const char* native, const Symbol* name, const char* data, size_t size)
+{
+	static atomic<unsigned> saves(0);
+
+	string path;
+	if (!dataPath(native, name, path))
+		return false;
+	string temporary = path + ".tmp." + to_string(getpid()) + "." + to_string(saves++);
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+	bool ok = fd >= 0;
+	while (ok && size)
+	{
+		ssize_t written = write(fd, data, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		ok = written > 0;
+		if (ok)
+		{
+			data += written;
+			size -= written;
+		}
+	}
+	if (fd >= 0 && close(fd))
+		ok = false;
+	if (ok && rename(temporary.c_str(), path.c_str()))
+		ok = false;
+	if (!ok)
+	{
+		int error = errno;
+		if (fd >= 0)
+			unlink(temporary.c_str());
+		fprintf(scriptErr, "%s: couldn't write %s: %s\n", native, name->string_value.c_str(), strerror(error));
+	}
+	return ok;
+}
+
+static void returnArray(Symbol &result, ArrayBuffer* array)
+{
+	result.type = Symbol::ARRAY;
+	result.array = array;
+}
+
+/* the integer a whole line spells, false if it isn't one */
+static bool parseInteger(const char* text, size_t length, int &value)
+{
+	size_t i = (length && text[0] == '-') ? 1 : 0;
+	if (i == length)
+		return false;
+	long long parsed = 0;
+	for (; i < length; i++)
+	{
+		if (text[i] < '0' || text[i] > '9')
+			return false;
+		parsed = parsed * 10 + (text[i] - '0');
+		if (parsed > (long long)INT_MAX + 1)
+			return false;
+	}
+	if (text[0] == '-')
+		parsed = -parsed;
+	if (parsed > INT_MAX || parsed < INT_MIN)
+		return false;
+	value = parsed;
+	return true;
+}
+
+bool nativeLoadInts(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::STRING)
+		return false;
+	shared_ptr<MappedFile> file = mapData("loadInts", args[0]);
+	if (!file)
+		return true;
+	if (file->size % sizeof(int32_t))
+	{
+		fprintf(scriptErr, "loadInts: %s is not whole 32-bit integers\n", args[0]->string_value.c_str());
+		return true;
+	}
+
+	ArrayBuffer* array = heap.allocate<ArrayBuffer>();
+	// mmap hands back page aligned memory
+	if (file->size)
+		array->pack(file, (const int32_t*)file->data, file->size / sizeof(int32_t));
+	returnArray(result, array);
+	return true;
+}
+
+bool nativeLoadLines(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::STRING)
+		return false;
+	shared_ptr<MappedFile> file = mapData("loadLines", args[0]);
+	if (!file)
+		return true;
+
+	// count first, so the cells are reserved against the limits once
+	const char* data = file->data;
+	const char* end = data + file->size;
+	size_t lines = 0;
+	for (const char* line = data; line < end; lines++)
+	{
+		const char* next = (const char*)memchr(line, '\n', end - line);
+		line = next ? next + 1 : end;
+	}
+	limits.reserve(lines * sizeof(Symbol));
+
+	ArrayBuffer* array = heap.allocate<ArrayBuffer>();
+	Array &cells = array->dense();
+	cells.reserve(lines);
+	for (const char* line = data; line < end;)
+	{
+		const char* next = (const char*)memchr(line, '\n', end - line);
+		size_t length = (next ? next : end) - line;
+		if (length && line[length - 1] == '\r')
+			length--;
+
+		Symbol* cell = heap.allocateAs<Symbol>(MemStats::ARRAY);
+		if (parseInteger(line, length, cell->int_value))
+			cell->type = Symbol::INTEGER;
+		else
+		{
+			cell->type = Symbol::STRING;
+			cell->string_value = String(string(line, length));
+		}
+		cell->assigned = true;
+		cells.push_back(cell);
+		line = next ? next + 1 : end;
+	}
+	returnArray(result, array);
+	return true;
+}
+
+bool nativeSaveInts(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::ARRAY || args[1]->type != Symbol::STRING)
+		return false;
+
+	size_t count = args[0]->arraySize();
+	const int32_t* values = args[0]->array ? args[0]->array->packedValues() : NULL;
+	vector<int32_t> gathered;
+	if (!values)
+	{
+		gathered.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const Symbol* cell = args[0]->arrayCell(i);
+			if (!cell || !cell->assigned || cell->type != Symbol::INTEGER)
+				return false;
+			gathered[i] = cell->int_value;
+		}
+		values = gathered.data();
+	}
+
+	if (writeData("saveInts", args[1], (const char*)values, count * sizeof(int32_t)))
+		returnInteger(result, count);
+	return true;
+}
+
+bool nativeSaveLines(Symbol &result, Symbol** args)
+{
+	if (args[0]->type != Symbol::ARRAY || args[1]->type != Symbol::STRING)
+		return false;
+
+	size_t count = args[0]->arraySize();
+	string text;
+	const int32_t* values = args[0]->array ? args[0]->array->packedValues() : NULL;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (values)
+		{
+			text += to_string(values[i]);
+			text += '\n';
+			continue;
+		}
+		const Symbol* cell = args[0]->arrayCell(i);
+		if (!cell || !cell->assigned)
+			return false;
+		if (cell->type == Symbol::INTEGER)
+			text += to_string(cell->int_value);
+		else if (cell->type == Symbol::STRING)
+			text += cell->string_value.str();
+		else if (cell->type == Symbol::BOOLEAN)
+			text += cell->bool_value ? "true" : "false";
+		else
+			return false;
+		text += '\n';
+	}
+
+	if (writeData("saveLines", args[1], text.data(), text.size()))
+		returnInteger(result, count);
+	return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * CS352 Spring 2015
+ * Bulk data files for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _DATAFILES_H
+#define _DATAFILES_H
+
+#include <cstddef>
+#include <string>
+
+class Symbol;
+
+/* a whole file mapped read-only, unmapped when the last user lets go */
+class MappedFile
+{
+public:
+	const char* data = NULL;
+	size_t size = 0;
+
+	/* false with errno set if it can't be opened or mapped */
+	bool map(const std::string &path);
+	~MappedFile();
+};
+
+/*
+ * Builtins moving whole arrays in and out of files under the data
+ * directory, in one go:
+ *
+ *   loadInts(path)         native byte order 32-bit integers, left where
+ *                          the file is mapped until a cell is written
+ *   loadLines(path)        a cell per line, integers where a line is one
+ *                          and strings otherwise
+ *   saveInts(array, path)  every cell must be an integer
+ *   saveLines(array, path) every cell must be an integer, string or boolean
+ *
+ * The saves return the number of cells written, and replace the file
+ * whole so arrays loaded from it earlier keep what they read. Files
+ * that can't be read or written are reported on the script's error
+ * stream and give no value back.
+ */
+bool nativeLoadInts(Symbol &result, Symbol** args);
+bool nativeLoadLines(Symbol &result, Symbol** args);
+bool nativeSaveInts(Symbol &result, Symbol** args);
+bool nativeSaveLines(Symbol &result, Symbol** args);
+
+/* paths are relative to this, NULL (the default) to allow no files at all */
+extern const char* dataDirectory;
+
+#endif // _DATAFILES_H
@@ -0,0 +1,608 @@
+/*
+ * CS352 Spring 2015
+ * Ahead-of-time compiler for miniscript
+ * Andrew F. Davis
+ */
+
+#include "emitcpp.hh"
+
+#include <cstdio>
+#include <algorithm>
+
+#include "runtime.hh"
+
+using namespace std;
+
+static const char* const opNames[Operation::DIVISION + 1] = {
+	"GT", "LT", "GE", "LE",
+	"NE", "EQ", "OR", "AND",
+	"ADDITION",
+	"SUBTRACTION",
+	"MULTIPLICATION",
+	"DIVISION",
+};
+
+static const char* const opSymbols[Operation::DIVISION + 1] = {
+	">", "<", ">=", "<=",
+	"!=", "==", "||", "&&",
+	"+",
+	"-",
+	"*",
+	"/",
+};
+
+static const char* const typeNames[Symbol::UNDEFINED + 1] = {
+	"STRING", "INTEGER", "BRTAG", "BOOLEAN",
+	"OBJECT", "ARRAY", "FUNCTION", "NATIVE", "UNDEFINED",
+};
+
+/* the C++ type and Symbol member holding a value of a primitive type */
+static const char* valueType(Symbol::Type type)
+{
+	switch (type)
+	{
+	case Symbol::INTEGER: return "int";
+	case Symbol::BOOLEAN: return "bool";
+	default: return "String";
+	}
+}
+
+static const char* valueMember(Symbol::Type type)
+{
+	switch (type)
+	{
+	case Symbol::INTEGER: return "int_value";
+	case Symbol::BOOLEAN: return "bool_value";
+	default: return "string_value";
+	}
+}
+
+/* the truth of a value of a primitive type, as getTruth has it */
+static string truth(Symbol::Type type, const string &value)
+{
+	switch (type)
+	{
+	case Symbol::INTEGER: return "(" + value + " != 0)";
+	case Symbol::BOOLEAN: return value;
+	default: return "!" + value + ".empty()";
+	}
+}
+
+string CppEmitter::unique(const char* prefix)
+{
+	return prefix + to_string(count++);
+}
+
+string CppEmitter::node(Expression* expression)
+{
+	auto found = names.find(expression);
+	if (found != names.end())
+		return found->second;
+	string name = expression->emitNode(*this);
+	names[expression] = name;
+	return name;
+}
+
+string CppEmitter::make(const char* type, const string &arguments)
+{
+	string name = unique("n");
+	declarations << "static " << type << "* " << name << ";\n";
+	nodes.push_back(name + " = new " + type + "(" + arguments + ");");
+	return name;
+}
+
+string CppEmitter::flag()
+{
+	string name = unique("e");
+	declarations << "static bool " << name << ";\n";
+	return name;
+}
+
+ostream& CppEmitter::line()
+{
+	for (int i = 0; i < depth; i++)
+		code << '\t';
+	return code;
+}
+
+void CppEmitter::open()
+{
+	line() << "{\n";
+	depth++;
+}
+
+void CppEmitter::close()
+{
+	depth--;
+	line() << "}\n";
+}
+
+void CppEmitter::statement(Statement* statement)
+{
+	open();
+	line() << "Statement::enter(" << statement->lineNumber << ");\n";
+	statement->emit(*this);
+	close();
+}
+
+void CppEmitter::statements(const list<Statement*>* statements)
+{
+	if (statements)
+		for (auto &it : *statements)
+			statement(it);
+}
+
+void CppEmitter::function(const string &name, const list<Statement*>* body)
+{
+	// functions can't be nested in C++, so this one goes on its own
+	ostringstream outer;
+	outer.swap(code);
+	int outerDepth = depth;
+	vector<string> outerLoops;
+	outerLoops.swap(loops);
+
+	code << "static void " << name << "(ContextPtr context)\n{\n";
+	depth = 1;
+	statements(body);
+	code << "}\n\n";
+	functions << code.str();
+
+	code.swap(outer);
+	depth = outerDepth;
+	loops.swap(outerLoops);
+}
+
+void CppEmitter::setupLine(const string &line)
+{
+	setup.push_back(line);
+}
+
+string CppEmitter::quote(const string &text)
+{
+	string quoted = "\"";
+	for (unsigned char c : text)
+	{
+		// a question mark could start a trigraph, which -std=c++11 reads
+		if (c == '"' || c == '\\' || c == '?')
+			quoted += string("\\") + (char)c;
+		else if (c == '\n')
+			quoted += "\\n";
+		else if (c == '\t')
+			quoted += "\\t";
+		else if (c < ' ' || c >= 0x7f)
+		{
+			// always three digits, so no digit after can join in
+			char escape[5];
+			snprintf(escape, sizeof(escape), "\\%03o", c);
+			quoted += escape;
+		}
+		else
+			quoted += c;
+	}
+	return quoted + "\"";
+}
+
+string CppEmitter::atom(const Atom* name)
+{
+	return "intern(" + quote(name->text) + ")";
+}
+
+void CppEmitter::program(list<Statement*>* statements, const char* source, ostream &out)
+{
+	// every function there is ends up registered globally, the
+	// last of any with the same name is the one that is called
+	vector<Function*> functionList;
+	for (auto &it : *globalContext)
+		if (it.symbol->type == Symbol::FUNCTION)
+			functionList.push_back(it.symbol->function);
+	stable_sort(functionList.begin(), functionList.end(),
+		[](const Function* a, const Function* b) { return a->lineNumber < b->lineNumber; });
+	for (auto &it : functionList)
+		it->emit(*this);
+
+	vector<pair<int, string>> topLevel;
+	if (statements)
+		for (auto &it : *statements)
+		{
+			string name = unique("s");
+			code << "static void " << name << "(ContextPtr context)\n{\n";
+			depth = 1;
+			statement(it);
+			code << "}\n\n";
+			topLevel.push_back(make_pair(it->lineNumber, name));
+		}
+
+	out << "/* compiled from " << source << " by minijs --emit-cpp */\n\n";
+	out << "#include \"compiled.hh\"\n\n";
+	out << "using namespace std;\n\n";
+	out << declarations.str() << "\n";
+	out << functions.str();
+	out << code.str();
+	vector<string> startup(nodes);
+	startup.insert(startup.end(), setup.begin(), setup.end());
+	size_t chunks = 0;
+	for (size_t i = 0; i < startup.size(); i += SETUP_CHUNK, chunks++)
+	{
+		out << "static void setup" << chunks << "()\n{\n";
+		for (size_t j = i; j < startup.size() && j < i + SETUP_CHUNK; j++)
+			out << "\t" << startup[j] << "\n";
+		out << "}\n\n";
+	}
+	out << "static void setup()\n{\n";
+	for (size_t i = 0; i < chunks; i++)
+		out << "\tsetup" << i << "();\n";
+	out << "}\n\n";
+	out << "static const CompiledStatement program[] = {\n";
+	for (auto &it : topLevel)
+		out << "\t{ " << it.first << ", " << it.second << " },\n";
+	out << "\t{ 0, NULL },\n};\n\n";
+	out << "int main(int argc, char* argv[])\n{\n";
+	out << "\treturn runCompiled(argc, argv, setup, program);\n}\n";
+}
+
+void emitCpp(list<Statement*>* program, const char* source, ostream &out)
+{
+	CppEmitter emitter;
+	emitter.program(program, source, out);
+}
+
+void DocumentWrite::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	for (auto &it : *parameters)
+	{
+		string value = out.node(it);
+		out.open();
+		// this makes every parameter report independently
+		string paramError = out.unique("p");
+		out.line() << "bool " << paramError << " = false;\n";
+		out.line() << "try\n";
+		out.open();
+		it->emitEvaluate(out, paramError);
+		out.close();
+		out.line() << "catch (ScriptAbort&) { throw; }\n";
+		out.line() << "catch (...) {}\n";
+		out.line() << "writeValue(" << value << "->symbol, " << flag << ", " << lineNumber << ");\n";
+		out.close();
+	}
+}
+
+void Declaration::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	string name = out.node(variable);
+	if (expression != NULL)
+	{
+		string value = out.node(expression);
+		out.line() << "try\n";
+		out.open();
+		expression->emitEvaluate(out, flag);
+		out.close();
+		out.line() << "catch (ScriptAbort&) { throw; }\n";
+		out.line() << "catch (...) {}\n";
+		out.line() << name << "->declare(context, " << flag << ");\n";
+		out.line() << name << "->assign(context, " << value << ", " << flag << ");\n";
+		return;
+	}
+
+	out.line() << name << "->declare(context, " << flag << ");\n";
+	if (object_init != NULL)
+	{
+		// the initializer list runs in the object's own context
+		string objectContext = out.unique("o");
+		out.line() << "ContextPtr " << objectContext << " = heap.allocate<Context>();\n";
+		out.line() << "getTableSymbol(context, " << name << "->name)->object = " << objectContext << ";\n";
+		out.line() << "HeapPin<Context> pin(" << objectContext << ");\n";
+		out.open();
+		out.line() << "ContextPtr context = " << objectContext << ";\n";
+		out.statements(object_init);
+		out.close();
+		out.line() << "getTableSymbol(context, " << name << "->name)->type = Symbol::OBJECT;\n";
+		out.line() << "getTableSymbol(context, " << name << "->name)->assigned = true;\n";
+	}
+	else if (array_init != NULL)
+	{
+		for (auto &it : *array_init)
+		{
+			string value = out.node(it);
+			it->emitEvaluate(out, flag);
+			out.open();
+			out.line() << "Symbol* cell = heap.allocateAs<Symbol>(MemStats::ARRAY);\n";
+			out.line() << "*cell = " << value << "->symbol;\n";
+			out.line() << "cell->share();\n";
+			out.line() << "cell->assigned = true;\n";
+			out.line() << "getTableSymbol(context, " << name << "->name)->writableArray().push_back(cell);\n";
+			out.close();
+		}
+		out.line() << "getTableSymbol(context, " << name << "->name)->type = Symbol::ARRAY;\n";
+		out.line() << "getTableSymbol(context, " << name << "->name)->assigned = true;\n";
+	}
+}
+
+void Assignment::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	string name = out.node(variable);
+	string value = out.node(expression);
+	out.line() << "try\n";
+	out.open();
+	expression->emitEvaluate(out, flag);
+	out.close();
+	out.line() << "catch (ScriptAbort&) { throw; }\n";
+	out.line() << "catch (...) {}\n";
+	out.line() << name << "->assign(context, " << value << ", " << flag << ");\n";
+}
+
+void Conditional::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	string value = out.node(condition);
+	string truth = out.unique("t");
+	string skip = out.unique("k");
+	out.line() << "bool " << truth << " = false, " << skip << " = false;\n";
+	out.line() << "try\n";
+	out.open();
+	condition->emitEvaluate(out, flag);
+	out.line() << truth << " = getTruth(" << value << ", " << flag << ");\n";
+	out.close();
+	out.line() << "catch (ScriptAbort&) { throw; }\n";
+	// this will cause us to just skip the conditional
+	out.line() << "catch (...) { " << skip << " = true; }\n";
+	out.line() << "if (!" << skip << " && " << truth << ")\n";
+	out.open();
+	out.statements(ifTrue);
+	out.close();
+	if (ifFalse && !ifFalse->empty())
+	{
+		out.line() << "else if (!" << skip << ")\n";
+		out.open();
+		out.statements(ifFalse);
+		out.close();
+	}
+}
+
+void Iterator::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	string value = out.node(condition);
+	string loop = out.unique("");
+	string go = "go" + loop;
+
+	out.line() << "try\n";
+	out.open();
+	out.line() << "bool " << go << " = true;\n";
+	if (testFirst)
+	{
+		condition->emitEvaluate(out, flag);
+		out.line() << go << " = getTruth(" << value << ", " << flag << ");\n";
+	}
+	out.line() << "while (" << go << ")\n";
+	out.open();
+	// a break or continue thrown from further away, from a function
+	// called in here, is caught just as the interpreter catches them
+	out.line() << "try\n";
+	out.open();
+	out.loops.push_back(loop);
+	out.statements(whileTrue);
+	out.loops.pop_back();
+	out.close();
+	out.line() << "catch (Break*) { goto break_" << loop << "; }\n";
+	out.line() << "catch (Continue*) {}\n";
+	out.line() << "continue_" << loop << ":\n";
+	// loop back-edges are a safepoint
+	out.line() << "safepoint();\n";
+	out.line() << "currentLine = " << condition->lineNumber << ";\n";
+	condition->emitEvaluate(out, flag);
+	out.line() << go << " = getTruth(" << value << ", " << flag << ");\n";
+	out.close();
+	out.close();
+	out.line() << "catch (ScriptAbort&) { throw; }\n";
+	out.line() << "catch (...) {}\n";
+	out.line() << "break_" << loop << ":;\n";
+}
+
+void Function::emit(CppEmitter &out)
+{
+	string compiledName = out.unique("f");
+	out.function(compiledName, body);
+
+	string params;
+	for (auto &it : *func_params)
+		params += (params.empty() ? "" : ", ") + CppEmitter::atom(it);
+	out.setupLine("(new Function(" + CppEmitter::atom(name) +
+		", new std::list<const Atom*>{" + params + "}, new std::list<Statement*>(), " +
+		to_string(lineNumber) + "))->compiled = " + compiledName + ";");
+}
+
+void Call::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	out.node(callable);
+	callable->emitEvaluate(out, flag);
+}
+
+void Break::emit(CppEmitter &out)
+{
+	if (!out.loops.empty())
+		out.line() << "goto break_" << out.loops.back() << ";\n";
+	else
+		out.line() << "throw " << out.make("Break", to_string(lineNumber)) << ";\n";
+}
+
+void Continue::emit(CppEmitter &out)
+{
+	if (!out.loops.empty())
+		out.line() << "goto continue_" << out.loops.back() << ";\n";
+	else
+		out.line() << "throw " << out.make("Continue", to_string(lineNumber)) << ";\n";
+}
+
+void Return::emit(CppEmitter &out)
+{
+	string flag = out.flag();
+	string value = out.node(ret);
+	ret->emitEvaluate(out, flag);
+	out.line() << "throw (Expression*)" << value << ";\n";
+}
+
+string Constant::emitNode(CppEmitter &out)
+{
+	string line = to_string(lineNumber);
+	switch (symbol.type)
+	{
+	case Symbol::INTEGER:
+		return out.make("IntConst", to_string(symbol.int_value) + ", " + line);
+	case Symbol::STRING:
+		return out.make("StringConst", "intern(" + CppEmitter::quote(symbol.string_value.str()) + "), " + line);
+	case Symbol::BRTAG:
+		return out.make("BRConst", line);
+	default:
+		return out.make("BoolConst", string(symbol.bool_value ? "true" : "false") + ", " + line);
+	}
+}
+
+string Variable::emitNode(CppEmitter &out)
+{
+	string line = to_string(lineNumber);
+	if (index != NULL)
+		return out.make("Variable", CppEmitter::atom(name) + ", " + out.node(index) + ", " + line);
+	if (object_name != NULL)
+		return out.make("Variable", CppEmitter::atom(name) + ", " + CppEmitter::atom(object_name) + ", " + line);
+	return out.make("Variable", CppEmitter::atom(name) + ", " + line);
+}
+
+void Variable::emitEvaluate(CppEmitter &out, const string &errorReported)
+{
+	string self = out.node(this);
+	string tableSymbol = out.unique("v");
+	out.open();
+	out.line() << "Symbol* " << tableSymbol << " = " << self << "->find(context, " << errorReported << ");\n";
+	out.line() << "if (" << tableSymbol << ")\n";
+	out.open();
+	if (index != NULL)
+	{
+		// evaluate the index, it may run code that collects
+		out.open();
+		out.line() << "HeapPin<Symbol> pin(" << tableSymbol << ");\n";
+		index->emitEvaluate(out, errorReported);
+		out.close();
+	}
+	out.line() << self << "->load(" << tableSymbol << ", " << errorReported << ");\n";
+	out.close();
+	out.close();
+}
+
+string Operation::emitNode(CppEmitter &out)
+{
+	string l = out.node(left);
+	string r = out.node(right);
+	return out.make("Operation", string("Operation::") + opNames[opType] + ", " + l + ", " + r + ", " +
+		to_string(lineNumber) + ", " + to_string(column));
+}
+
+void Operation::emitEvaluate(CppEmitter &out, const string &errorReported)
+{
+	string self = out.node(this);
+	string l = out.node(left);
+	string r = out.node(right);
+	Symbol::Type type = left->provenType;
+
+	left->emitEvaluate(out, errorReported);
+
+	if (type != Symbol::UNDEFINED && type == right->provenType && resultType(opType, type) != Symbol::UNDEFINED)
+	{
+		// both sides are proven, as for our unchecked quick evaluate
+		Symbol::Type result = resultType(opType, type);
+		string member = string("->symbol.") + valueMember(type);
+		if (opType == Operation::AND || opType == Operation::OR)
+		{
+			out.line() << "if (" << (opType == Operation::AND ? "!" : "") << truth(type, l + member) << ")\n";
+			out.open();
+			out.line() << self << "->symbol.bool_value = " << (opType == Operation::OR ? "true" : "false") << ";\n";
+			out.line() << self << "->symbol.type = Symbol::BOOLEAN;\n";
+			out.close();
+			out.line() << "else\n";
+		}
+		out.open();
+		// right may re-evaluate left, so hold on to its value
+		string saved = out.unique("l");
+		out.line() << valueType(type) << " " << saved << " = " << l << member << ";\n";
+		right->emitEvaluate(out, errorReported);
+		string value;
+		if (opType == Operation::AND || opType == Operation::OR)
+			value = truth(type, saved) + " " + opSymbols[opType] + " " + truth(type, r + member);
+		else
+			value = saved + " " + opSymbols[opType] + " " + r + member;
+		out.line() << self << "->symbol." << valueMember(result) << " = " << value << ";\n";
+		out.line() << self << "->symbol.type = Symbol::" << typeNames[result] << ";\n";
+		out.close();
+		return;
+	}
+
+	out.line() << "if (!" << self << "->shortCircuit(" << errorReported << "))\n";
+	out.open();
+	// right may re-evaluate left, so we save its value first
+	string saved = out.unique("l");
+	out.line() << "Constant " << saved << "(0);\n";
+	out.line() << saved << ".symbol = " << l << "->symbol;\n";
+	right->emitEvaluate(out, errorReported);
+	out.line() << self << "->combine(&" << saved << ", " << errorReported << ");\n";
+	out.close();
+}
+
+string Negate::emitNode(CppEmitter &out)
+{
+	return out.make("Negate", out.node(right) + ", " + to_string(lineNumber));
+}
+
+void Negate::emitEvaluate(CppEmitter &out, const string &errorReported)
+{
+	string self = out.node(this);
+	string r = out.node(right);
+	right->emitEvaluate(out, errorReported);
+	if (checked)
+	{
+		out.line() << self << "->negate(" << errorReported << ");\n";
+		return;
+	}
+	// our operand is proven truthy
+	Symbol::Type type = right->provenType;
+	out.line() << self << "->symbol.bool_value = !" << truth(type, r + "->symbol." + valueMember(type)) << ";\n";
+	out.line() << self << "->symbol.type = Symbol::BOOLEAN;\n";
+}
+
+string Callable::emitNode(CppEmitter &out)
+{
+	string arguments;
+	for (auto &it : *parameters)
+		arguments += (arguments.empty() ? "" : ", ") + out.node(it);
+	return out.make("Callable", CppEmitter::atom(name) + ", new std::list<Expression*>{" + arguments + "}, " + to_string(lineNumber));
+}
+
+void Callable::emitEvaluate(CppEmitter &out, const string &errorReported)
+{
+	string self = out.node(this);
+	string callee = out.unique("c");
+	out.open();
+	out.line() << "Symbol* " << callee << " = " << self << "->callee(context, " << errorReported << ");\n";
+	// natives take their arguments straight from us
+	out.line() << "if (" << callee << " && " << callee << "->type == Symbol::NATIVE)\n";
+	out.line() << "\t" << self << "->callNative(context, " << callee << "->native, " << errorReported << ");\n";
+	out.line() << "else if (" << callee << ")\n";
+	out.open();
+	out.line() << "HeapPin<Symbol> pin(" << callee << ");\n";
+	for (auto &it : *parameters)
+	{
+		string argument = out.node(it);
+		out.open();
+		// this makes every parameter report independently
+		string paramError = out.unique("p");
+		out.line() << "bool " << paramError << " = false;\n";
+		it->emitEvaluate(out, paramError);
+		out.close();
+		out.line() << "callStack.push(" << argument << ");\n";
+	}
+	out.line() << self << "->invoke(" << callee << "->function, context);\n";
+	out.close();
+	out.close();
+}
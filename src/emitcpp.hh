@@ -0,0 +1,82 @@
+/*
+ * CS352 Spring 2015
+ * Ahead-of-time compiler for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _EMITCPP_H
+#define _EMITCPP_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <ostream>
+
+#include "ast.hh"
+
+/*
+ * Writes a parsed and type checked program out as C++ to be built
+ * against the runtime, see compiled.hh. Statements and expressions
+ * write their own code through here, each statement as what its
+ * execute does, each expression as what its evaluate does, leaving
+ * its value in the symbol of a copy of the node the program makes at
+ * startup.
+ */
+class CppEmitter
+{
+public:
+	/* the whole program, source names the script it came from */
+	void program(std::list<Statement*>* statements, const char* source, std::ostream &out);
+
+	/* a name nothing else in the program has, starting with prefix */
+	std::string unique(const char* prefix);
+	/* the variable a node is kept in, made first if it isn't yet */
+	std::string node(Expression* expression);
+	/* a variable of this type holding what arguments make, for emitNode */
+	std::string make(const char* type, const std::string &arguments);
+	/* a flag kept across runs, for a statement's errorReported */
+	std::string flag();
+
+	/* start a line of the code being written */
+	std::ostream& line();
+	/* "{" and "}", the code between indented */
+	void open();
+	void close();
+	/* a statement, as the current line */
+	void statement(Statement* statement);
+	void statements(const std::list<Statement*>* statements);
+	/* a function of its own running these statements */
+	void function(const std::string &name, const std::list<Statement*>* body);
+	/* a line run at startup, after every node is made */
+	void setupLine(const std::string &line);
+
+	/* text as a C++ string literal */
+	static std::string quote(const std::string &text);
+	/* the atom a name is, made at startup */
+	static std::string atom(const Atom* name);
+
+	/* the loops around the code being written, innermost last; a break
+	 * or continue in one jumps to its labels instead of throwing */
+	std::vector<std::string> loops;
+
+private:
+	/* lines run at startup, split up into functions of this many
+	 * so a big program doesn't make one the compiler chokes on */
+	static const size_t SETUP_CHUNK = 256;
+
+	std::ostringstream declarations;
+	std::vector<std::string> nodes;
+	std::vector<std::string> setup;
+	std::ostringstream functions;
+	std::ostringstream code;
+	std::map<const Expression*, std::string> names;
+	unsigned int count = 0;
+	int depth = 0;
+};
+
+/* write a program out as C++, functions and all */
+void emitCpp(std::list<Statement*>* program, const char* source, std::ostream &out);
+
+#endif // _EMITCPP_H
@@ -12,36 +12,68 @@
 
 #include "miniscript.hh"
 #include "ast.hh"
+#include "builtins.hh"
 
 using namespace std;
 
 void Operation::evaluate(ContextPtr context, bool &errorReported)
 {
+	// run our type-specialized self if we have been quickened
+	if (quick)
+	{
+		(this->*quick)(context, errorReported);
+		return;
+	}
+
 	// evaluate both sides of our operation
 	left->evaluate(context, errorReported);
+	evaluateGeneric(context, errorReported);
+}
+
+// NOTE: This assumes left has already been evaluated
+void Operation::evaluateGeneric(ContextPtr context, bool &errorReported)
+{
+	if (shortCircuit(errorReported))
+		return;
 
+	// now with function calls (right) may re-evaluate (left)
+	// changing its value before we extract it in its current
+	// incarnation, so we save (left)'s value here before we call (right)
+	Constant savedLeft(0);
+	Constant* newLeft = &savedLeft;
+	newLeft->symbol = left->symbol;
+
+	right->evaluate(context, errorReported);
+
+	combine(newLeft, errorReported);
+
+	// specialize ourselves for next time if both sides agree
+	if (newLeft->symbol.type == right->symbol.type && deopts < MAX_DEOPTS)
+		quicken(newLeft->symbol.type);
+}
+
+// NOTE: This assumes left has already been evaluated
+bool Operation::shortCircuit(bool &errorReported)
+{
 	// check if we can short-circuit evaluate
 	if (opType == Operation::AND && getTruth(left, errorReported) == false)
 	{
 		symbol.bool_value = false;
 		symbol.type = Symbol::BOOLEAN;
-		return;
+		return true;
 	}
 	else if (opType == Operation::OR && getTruth(left, errorReported) == true)
 	{
 		symbol.bool_value = true;
 		symbol.type = Symbol::BOOLEAN;
-		return;
+		return true;
 	}
+	return false;
+}
 
-	// now with function calls (right) may re-evaluate (left)
-	// changing its value before we extract it in its current
-	// incarnation, so we save (left)'s value here before we call (right)
-	shared_ptr<Constant> newLeft(new Constant(0));
-	newLeft->symbol = left->symbol;
-
-	right->evaluate(context, errorReported);
-
+// NOTE: This assumes right has already been evaluated
+void Operation::combine(Expression* newLeft, bool &errorReported)
+{
 	// if one of the sides is undefined
 	if (newLeft->symbol.type == Symbol::UNDEFINED ||
 		right->symbol.type == Symbol::UNDEFINED)
@@ -58,7 +90,7 @@ void Operation::evaluate(ContextPtr context, bool &errorReported)
 			right->symbol.type == Symbol::INTEGER ||
 			right->symbol.type == Symbol::BOOLEAN))
 		{
-			bool leftTruth = getTruth(newLeft.get(), errorReported);
+			bool leftTruth = getTruth(newLeft, errorReported);
 			bool rightTruth = getTruth(right, errorReported);
 			switch (opType)
 			{
@@ -207,12 +239,210 @@ void Operation::evaluate(ContextPtr context, bool &errorReported)
 	}
 }
 
+/*
+ * Quickening: after its first run an Operation whose operands were of
+ * the same primitive type swaps in a version of itself specialized for
+ * that type and operator. The specialized version guards on the operand
+ * types and drops back to the generic path when they change.
+ */
+
+/* how to get at a value of each primitive type */
+template <Symbol::Type type> struct Slot;
+
+template <> struct Slot<Symbol::INTEGER>
+{
+	typedef int Value;
+	static Value get(const Symbol &symbol) { return symbol.int_value; }
+	static void set(Symbol &symbol, Value value) { symbol.int_value = value; }
+	static bool truth(Value value) { return value != 0; }
+};
+
+template <> struct Slot<Symbol::BOOLEAN>
+{
+	typedef bool Value;
+	static Value get(const Symbol &symbol) { return symbol.bool_value; }
+	static void set(Symbol &symbol, Value value) { symbol.bool_value = value; }
+	static bool truth(Value value) { return value; }
+};
+
+template <> struct Slot<Symbol::STRING>
+{
+	typedef String Value;
+	static const Value& get(const Symbol &symbol) { return symbol.string_value; }
+	static void set(Symbol &symbol, const Value &value) { symbol.string_value = value; }
+	static bool truth(const Value &value) { return !value.empty(); }
+};
+
+/* operator table, only the combinations defined here get quickened */
+template <Operation::OpType op, Symbol::Type type>
+struct Native
+{
+	static const bool supported = false;
+	static const Symbol::Type result = Symbol::UNDEFINED;
+};
+
+#define NATIVE(op, operands, yields, expression) \
+template <> struct Native<Operation::op, Symbol::operands> \
+{ \
+	static const bool supported = true; \
+	static const Symbol::Type result = Symbol::yields; \
+	static void apply(Symbol &symbol, const Slot<Symbol::operands>::Value &l, const Slot<Symbol::operands>::Value &r) \
+	{ \
+		Slot<Symbol::yields>::set(symbol, (expression)); \
+		symbol.type = Symbol::yields; \
+	} \
+};
+
+NATIVE(ADDITION,       INTEGER, INTEGER, l + r)
+NATIVE(SUBTRACTION,    INTEGER, INTEGER, l - r)
+NATIVE(MULTIPLICATION, INTEGER, INTEGER, l * r)
+NATIVE(DIVISION,       INTEGER, INTEGER, l / r)
+NATIVE(GT,             INTEGER, BOOLEAN, l > r)
+NATIVE(LT,             INTEGER, BOOLEAN, l < r)
+NATIVE(GE,             INTEGER, BOOLEAN, l >= r)
+NATIVE(LE,             INTEGER, BOOLEAN, l <= r)
+NATIVE(OR,             INTEGER, BOOLEAN, l || r)
+NATIVE(AND,            INTEGER, BOOLEAN, l && r)
+NATIVE(EQ,             INTEGER, BOOLEAN, l == r)
+NATIVE(NE,             INTEGER, BOOLEAN, l != r)
+
+NATIVE(ADDITION,       STRING,  STRING,  l + r)
+NATIVE(OR,             STRING,  BOOLEAN, !l.empty() || !r.empty())
+NATIVE(AND,            STRING,  BOOLEAN, !l.empty() && !r.empty())
+NATIVE(EQ,             STRING,  BOOLEAN, l == r)
+NATIVE(NE,             STRING,  BOOLEAN, l != r)
+
+NATIVE(OR,             BOOLEAN, BOOLEAN, l || r)
+NATIVE(AND,            BOOLEAN, BOOLEAN, l && r)
+NATIVE(EQ,             BOOLEAN, BOOLEAN, l == r)
+NATIVE(NE,             BOOLEAN, BOOLEAN, l != r)
+
+#undef NATIVE
+
+template <Operation::OpType op, Symbol::Type type, bool checked>
+void Operation::evaluateQuick(ContextPtr context, bool &errorReported)
+{
+	typedef Slot<type> S;
+
+	left->evaluate(context, errorReported);
+	if (checked && left->symbol.type != type)
+	{
+		// not what we specialized for, go back to being generic
+		deopts++;
+		quick = NULL;
+		evaluateGeneric(context, errorReported);
+		return;
+	}
+
+	// short-circuit, as in the generic version
+	if ((op == Operation::AND && !S::truth(S::get(left->symbol))) ||
+		(op == Operation::OR && S::truth(S::get(left->symbol))))
+	{
+		symbol.bool_value = (op == Operation::OR);
+		symbol.type = Symbol::BOOLEAN;
+		return;
+	}
+
+	// right may re-evaluate left, so hold on to its value
+	typename S::Value leftValue = S::get(left->symbol);
+
+	right->evaluate(context, errorReported);
+	if (checked && right->symbol.type != type)
+	{
+		deopts++;
+		quick = NULL;
+		Constant savedLeft(0);
+		savedLeft.symbol.type = type;
+		S::set(savedLeft.symbol, leftValue);
+		combine(&savedLeft, errorReported);
+		return;
+	}
+
+	Native<op, type>::apply(symbol, leftValue, S::get(right->symbol));
+}
+
+/* picks out the specialized evaluate for the supported combinations */
+template <Operation::OpType op, Symbol::Type type, bool checked, bool supported = Native<op, type>::supported>
+struct QuickEntry
+{
+	static Operation::QuickEvaluate get() { return NULL; }
+};
+
+template <Operation::OpType op, Symbol::Type type, bool checked>
+struct QuickEntry<op, type, checked, true>
+{
+	static Operation::QuickEvaluate get() { return &Operation::evaluateQuick<op, type, checked>; }
+};
+
+#define QUICK_ROW(op, checked) { \
+	QuickEntry<Operation::op, Symbol::STRING, checked>::get(), \
+	QuickEntry<Operation::op, Symbol::INTEGER, checked>::get(), \
+	NULL, /* BRTAG */ \
+	QuickEntry<Operation::op, Symbol::BOOLEAN, checked>::get() }
+
+#define QUICK_TABLE(checked) { \
+	QUICK_ROW(GT, checked), QUICK_ROW(LT, checked), QUICK_ROW(GE, checked), QUICK_ROW(LE, checked), \
+	QUICK_ROW(NE, checked), QUICK_ROW(EQ, checked), QUICK_ROW(OR, checked), QUICK_ROW(AND, checked), \
+	QUICK_ROW(ADDITION, checked), \
+	QUICK_ROW(SUBTRACTION, checked), \
+	QUICK_ROW(MULTIPLICATION, checked), \
+	QUICK_ROW(DIVISION, checked) }
+
+/* indexed by [checked][opType][type] */
+static const Operation::QuickEvaluate quickTable[2][Operation::DIVISION + 1][Symbol::BOOLEAN + 1] = {
+	QUICK_TABLE(false),
+	QUICK_TABLE(true),
+};
+
+#define RESULT_ROW(op) { \
+	Native<Operation::op, Symbol::STRING>::result, \
+	Native<Operation::op, Symbol::INTEGER>::result, \
+	Symbol::UNDEFINED, /* BRTAG */ \
+	Native<Operation::op, Symbol::BOOLEAN>::result }
+
+static const Symbol::Type resultTable[Operation::DIVISION + 1][Symbol::BOOLEAN + 1] = {
+	RESULT_ROW(GT), RESULT_ROW(LT), RESULT_ROW(GE), RESULT_ROW(LE),
+	RESULT_ROW(NE), RESULT_ROW(EQ), RESULT_ROW(OR), RESULT_ROW(AND),
+	RESULT_ROW(ADDITION),
+	RESULT_ROW(SUBTRACTION),
+	RESULT_ROW(MULTIPLICATION),
+	RESULT_ROW(DIVISION),
+};
+
+#undef QUICK_ROW
+#undef QUICK_TABLE
+#undef RESULT_ROW
+
+void Operation::quicken(Symbol::Type type, bool checked)
+{
+	if (type <= Symbol::BOOLEAN)
+	{
+		quick = quickTable[checked][opType][type];
+		quickType = type;
+	}
+}
+
+Symbol::Type Operation::resultType(OpType op, Symbol::Type type)
+{
+	if (type > Symbol::BOOLEAN)
+		return Symbol::UNDEFINED;
+	return resultTable[op][type];
+}
+
 void Negate::evaluate(ContextPtr context, bool &errorReported)
 {
 	// evaluate of our operand
 	right->evaluate(context, errorReported);
-	// negation only works on truthy types
-	if (right->symbol.type != Symbol::BOOLEAN &&
+	negate(errorReported);
+}
+
+// NOTE: This assumes right has already been evaluated
+void Negate::negate(bool &errorReported)
+{
+	// negation only works on truthy types, which
+	// we don't need to check if it has been proven
+	if (checked &&
+		right->symbol.type != Symbol::BOOLEAN &&
 		right->symbol.type != Symbol::INTEGER &&
 		right->symbol.type != Symbol::STRING)
 	{
@@ -227,7 +457,21 @@ void Negate::evaluate(ContextPtr context, bool &errorReported)
 
 void Variable::evaluate(ContextPtr context, bool &errorReported)
 {
-	shared_ptr<Symbol> tableSymbol = getTableSymbol(context, name);
+	Symbol* tableSymbol = find(context, errorReported);
+	if (!tableSymbol)
+		return;
+	if (index != NULL)
+	{
+		// evaluate the index, it may run code that collects
+		HeapPin<Symbol> pin(tableSymbol);
+		index->evaluate(context, errorReported);
+	}
+	load(tableSymbol, errorReported);
+}
+
+Symbol* Variable::find(ContextPtr context, bool &errorReported)
+{
+	Symbol* tableSymbol = getTableSymbol(context, name);
 
 	// first check if it has been declared
 	if (!tableSymbol->declared)
@@ -238,16 +482,22 @@ void Variable::evaluate(ContextPtr context, bool &errorReported)
 		if (!tableSymbol->declared)
 		{
 			// use before being declared is a value error
-			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name);
-			return;
+			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name->text);
+			return NULL;
 		}
 	}
+	// natives can only be called, as a value their name is undeclared
+	if (tableSymbol->type == Symbol::NATIVE)
+	{
+		MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name->text);
+		return NULL;
+	}
 	// now we check if it has been previously assigned
 	if (!tableSymbol->assigned)
 	{
 		// print an error message if not
-		MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name);
-		return;
+		MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name->text);
+		return NULL;
 	}
 
 	// check if the variable is an object but not
@@ -255,24 +505,24 @@ void Variable::evaluate(ContextPtr context, bool &errorReported)
 	if (tableSymbol->type == Symbol::OBJECT)
 	{
 		// if not referencing a member
-		if (object_name.empty())
+		if (object_name == NULL)
 		{
 			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-			return;
+			return NULL;
 		}
 	}
 
 	// now check to see if it is used like an object
 	// note: this could be made into a loop to allow
 	// nested objects
-	if (!object_name.empty())
+	if (object_name != NULL)
 	{
 		if (tableSymbol->type != Symbol::OBJECT)
 		{
 			// it's a type violation to use a non
 			// object type like an object
 			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-			return;
+			return NULL;
 		}
 		// if it is we get our symbol information
 		// from the object pointer
@@ -282,15 +532,15 @@ void Variable::evaluate(ContextPtr context, bool &errorReported)
 		if (!tableSymbol->declared)
 		{
 			// use before being declared is a value error
-			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name + "." + object_name);
-			return;
+			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name->text + "." + object_name->text);
+			return NULL;
 		}
 		// now we check if it has been previously assigned
 		if (!tableSymbol->assigned)
 		{
 			// print an error message if not
-			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name + "." + object_name);
-			return;
+			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name->text + "." + object_name->text);
+			return NULL;
 		}
 	}
 	else
@@ -299,17 +549,19 @@ void Variable::evaluate(ContextPtr context, bool &errorReported)
 		if (tableSymbol->type == Symbol::OBJECT)
 		{
 			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-			return;
+			return NULL;
 		}
 	}
 
-	// now check to see if it is used like an object
-	// note: this could be made into a loop to allow
-	// nested objects
+	return tableSymbol;
+}
+
+// NOTE: This assumes any index has already been evaluated
+void Variable::load(Symbol* tableSymbol, bool &errorReported)
+{
+	// now check to see if it is used like an array
 	if (index != NULL)
 	{
-		// evaluate the index
-		index->evaluate(context, errorReported);
 		// only integer indexes accepted
 		if (index->symbol.type != Symbol::INTEGER)
 		{
@@ -325,24 +577,22 @@ void Variable::evaluate(ContextPtr context, bool &errorReported)
 			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
 			return;
 		}
-		// if we are out of bounds we resize
-		if ((unsigned)index->symbol.int_value >= tableSymbol->array.size())
-		{
-			int resizeAmount = (index->symbol.int_value - tableSymbol->array.size()) + 1;
-			for (int i = 0; i < resizeAmount; i++)
-				tableSymbol->array.push_back(make_shared<Symbol>());
-		}
-		// get our symbol from the array for this variable
-		tableSymbol = tableSymbol->array[index->symbol.int_value];
+		// get our symbol from the array for this variable,
+		// there is none past the end or in a sparse gap
+		Symbol* cell = NULL;
+		if (index->symbol.int_value >= 0)
+			cell = tableSymbol->arrayCell(index->symbol.int_value);
 
 		// now we check if it has been previously assigned
-		if (!tableSymbol->assigned)
+		if (!cell || !cell->assigned)
 		{
 			// print an error message if not
-			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, name + "[" +
-				static_cast<ostringstream*>(&(ostringstream() << (index->symbol.int_value)))->str() +"]");
+			ostringstream indexName;
+			indexName << name->text << "[" << index->symbol.int_value << "]";
+			MS_ERROR::report(errorReported, MS_ERROR::VALUE, lineNumber, indexName.str());
 			return;
 		}
+		tableSymbol = cell;
 	}
 	else
 	{
@@ -364,21 +614,23 @@ void Variable::declare(ContextPtr context, bool &errorReported)
 //	if ((*context).count(name))
 //		delete (*context)[name]; // free its memory
 	// add our new variable to the table
-	(*context)[name] = make_shared<Symbol>();
+	Symbol* newSymbol = heap.allocate<Symbol>();
 	// it has been declared
-	(*context)[name]->declared = true;
+	newSymbol->declared = true;
+	context->insert(name, newSymbol);
 }
 
 // NOTE: This assumes the expression already has its local
 // symbol info filled out ( evaluate called )
 void Variable::assign(ContextPtr context, Expression* expression, bool &errorReported)
 {
-	shared_ptr<Symbol> tableSymbol = getTableSymbol(context, name);
-	// now we check if it has been previously declared
-	if (!tableSymbol->declared)
+	Symbol* tableSymbol = getTableSymbol(context, name);
+	// now we check if it has been previously declared,
+	// a native's name isn't as far as the script goes
+	if (!tableSymbol->declared || tableSymbol->type == Symbol::NATIVE)
 	{
 		// print an error message if not
-		MS_ERROR::report(errorReported, MS_ERROR::UNDECLARED, lineNumber, name);
+		MS_ERROR::report(errorReported, MS_ERROR::UNDECLARED, lineNumber, name->text);
 		// Lab3 part 3.2 states we now consider this variable declared
 		tableSymbol->declared = true;
 	}
@@ -386,7 +638,7 @@ void Variable::assign(ContextPtr context, Expression* expression, bool &errorRep
 	// now check to see if it is used like an object
 	// note: this could be made into a loop to allow
 	// nested objects
-	if (!object_name.empty())
+	if (object_name != NULL)
 	{
 		if (tableSymbol->type != Symbol::OBJECT)
 		{
@@ -418,7 +670,8 @@ void Variable::assign(ContextPtr context, Expression* expression, bool &errorRep
 	// We have been accessed though an index
 	if (index != NULL)
 	{
-		// evaluate the index
+		// evaluate the index, it may run code that collects
+		HeapPin<Symbol> pin(tableSymbol);
 		index->evaluate(context, errorReported);
 		// only integer indexes accepted
 		if (index->symbol.type != Symbol::INTEGER)
@@ -426,15 +679,15 @@ void Variable::assign(ContextPtr context, Expression* expression, bool &errorRep
 			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
 			return;
 		}
-		// if we are out of bounds we resize
-		if ((unsigned)index->symbol.int_value >= tableSymbol->array.size())
+		// there is nowhere before the start to write to
+		if (index->symbol.int_value < 0)
 		{
-			int resizeAmount = (index->symbol.int_value - tableSymbol->array.size()) + 1;
-			for (int i = 0; i < resizeAmount; i++)
-				tableSymbol->array.push_back(make_shared<Symbol>());
+			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+			return;
 		}
-		// get our symbol from the array for this variable
-		tableSymbol = tableSymbol->array[index->symbol.int_value];
+		// writing through an index unshares the cells, and
+		// if we are out of bounds we grow
+		tableSymbol = tableSymbol->writableBuffer()->cell(index->symbol.int_value);
 	}
 	else
 	{
@@ -448,8 +701,9 @@ void Variable::assign(ContextPtr context, Expression* expression, bool &errorRep
 
 	// save old declared
 	bool declaredTemp = tableSymbol->declared;
-	// do the actual assignment
+	// do the actual assignment, sharing any array cells
 	*tableSymbol = expression->symbol;
+	tableSymbol->share();
 	// restore old declared
 	tableSymbol->declared = declaredTemp;
 	// mark the variable as having been assigned
@@ -457,9 +711,45 @@ void Variable::assign(ContextPtr context, Expression* expression, bool &errorRep
 }
 
 void Callable::evaluate(ContextPtr context, bool &errorReported)
+{
+	Symbol* tableSymbol = callee(context, errorReported);
+	if (!tableSymbol)
+		return;
+
+	// natives take their arguments straight from us
+	if (tableSymbol->type == Symbol::NATIVE)
+	{
+		callNative(context, tableSymbol->native, errorReported);
+		return;
+	}
+
+	// a function copied in here needs no frame, unless we are
+	// already running the copy further up the stack, or it has
+	// failed where the values it leaves behind start to matter
+	if (tableSymbol->function == inlinedFunction && !inlineActive && !inlinedReturn->errorReported)
+	{
+		evaluateInlined(context);
+		return;
+	}
+
+	// iterate over the parameters
+	HeapPin<Symbol> pin(tableSymbol);
+	for (std::list<Expression*>::const_iterator it = parameters->begin(), end = parameters->end(); it != end; ++it)
+	{
+		// this makes every parameter report independently
+		bool paramError = false;
+		(*it)->evaluate(context, paramError);
+		// now we push the evaluated expression onto the runtime stack
+		callStack.push((*it));
+	}
+
+	invoke(tableSymbol->function, context);
+}
+
+Symbol* Callable::callee(ContextPtr context, bool &errorReported)
 {
 	// get function pointer out of our symbol table
-	shared_ptr<Symbol> tableSymbol = getTableSymbol(context, name);
+	Symbol* tableSymbol = getTableSymbol(context, name);
 	// check if the function has been declared
 	if (!tableSymbol->declared)
 	{
@@ -470,43 +760,132 @@ void Callable::evaluate(ContextPtr context, bool &errorReported)
 		{
 			// use before being declared is a type violation
 			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-			return;
+			return NULL;
 		}
 	}
 
+	// natives check their own arguments
+	if (tableSymbol->type == Symbol::NATIVE)
+		return tableSymbol;
+
 	// ensure it is actually a function
 	if (tableSymbol->type != Symbol::FUNCTION)
 	{
 		// it's a type violation to call a variable
 		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-		return;
+		return NULL;
 	}
 
 	// check for matching number of parameters
 	if (parameters->size() != (tableSymbol->function)->getNumberOfArgs())
 	{
 		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+		return NULL;
+	}
+
+	return tableSymbol;
+}
+
+// NOTE: This assumes the arguments are already on the call stack
+void Callable::invoke(Function* function, ContextPtr context)
+{
+	// call the function
+	int callerLine = currentLine;
+	try { function->execute(context); }
+	catch (Expression* ret)
+	{
+		currentLine = callerLine;
+		// copy from the return value
+		symbol = (ret->symbol); // http://i.imgur.com/eAjDV5C.jpg
 		return;
 	}
+	currentLine = callerLine;
 
-	// iterate over the parameters
+	// if we get this far then the function returned without a return statement
+}
+
+void Callable::evaluateInlined(ContextPtr context)
+{
+	// the arguments are evaluated just as for a call
+	size_t i = 0;
+	for (std::list<Expression*>::const_iterator it = parameters->begin(), end = parameters->end(); it != end; ++it, i++)
+	{
+		bool paramError = false;
+		(*it)->evaluate(context, paramError);
+		inlinedValues[i] = (*it)->symbol;
+	}
+
+	// the body runs as the function's return statement would,
+	// reporting errors against it, with nothing but the
+	// parameters we stand in for between it and the globals
+	// failing, it leaves what the function returned last time
+	Expression* original = inlinedReturn->getValue();
+	inlined->symbol = original->symbol;
+
+	int callerLine = currentLine;
+	Statement::enter(inlinedReturn->lineNumber);
+	inlineActive = true;
+	try { inlined->evaluate(globalContext, inlinedReturn->errorReported); }
+	catch (...)
+	{
+		inlineActive = false;
+		throw;
+	}
+	inlineActive = false;
+	currentLine = callerLine;
+
+	original->symbol = inlined->symbol;
+	symbol = inlined->symbol;
+}
+
+// An array can't be evaluated by itself, so natives get
+// handed the table symbol of an array passed by name
+static Symbol* arrayByName(ContextPtr context, Expression* expression)
+{
+	Variable* variable = dynamic_cast<Variable*>(expression);
+	if (!variable || variable->index != NULL || variable->object_name != NULL)
+		return NULL;
+	Symbol* tableSymbol = getTableSymbol(context, variable->name);
+	if (!tableSymbol->declared)
+		tableSymbol = getTableSymbol(globalContext, variable->name);
+	if (!tableSymbol->declared || !tableSymbol->assigned || tableSymbol->type != Symbol::ARRAY)
+		return NULL;
+	return tableSymbol;
+}
+
+void Callable::callNative(ContextPtr context, const NativeFunction* native, bool &errorReported)
+{
+	metrics.add(Metrics::CALLS);
+	// check for matching number of parameters
+	if (parameters->size() != native->arity)
+	{
+		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+		return;
+	}
+
+	// evaluate everything first, any of it may run code
 	for (std::list<Expression*>::const_iterator it = parameters->begin(), end = parameters->end(); it != end; ++it)
 	{
+		if (arrayByName(context, *it))
+			continue;
 		// this makes every parameter report independently
 		bool paramError = false;
 		(*it)->evaluate(context, paramError);
-		// now we push the evaluated expression onto the runtime stack
-		callStack.push((*it));
 	}
 
-	// call the function
-	try { (tableSymbol->function)->execute(context); }
-	catch (Expression* ret)
+	// then look up arrays, nothing runs between here and the call
+	std::vector<Symbol*> args;
+	for (std::list<Expression*>::const_iterator it = parameters->begin(), end = parameters->end(); it != end; ++it)
 	{
-		// copy from the return value
-		symbol = (ret->symbol); // http://i.imgur.com/eAjDV5C.jpg
-		return;
+		Symbol* array = arrayByName(context, *it);
+		args.push_back(array ? array : &(*it)->symbol);
 	}
 
-	// if we get this far then the function returned without a return statement
+	Symbol result;
+	if (!native->call(result, args.data()))
+	{
+		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+		return;
+	}
+	symbol = result;
 }
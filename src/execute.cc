@@ -22,43 +22,52 @@ void DocumentWrite::execute(ContextPtr context)
 		// this makes every parameter report independently
 		bool paramError = false;
 		try { (*it)->evaluate(context, paramError); }
+		catch (ScriptAbort&) { throw; }
 		catch (...) {} // TODO: something...
-		switch ((*it)->symbol.type)
-		{
-		case Symbol::STRING:
-			printf("%s", (*it)->symbol.string_value.c_str());
-			break;
-		case Symbol::INTEGER:
-			printf("%d", (*it)->symbol.int_value);
-			break;
-		case Symbol::BRTAG:
-			printf("\n");
-			break;
-		case Symbol::BOOLEAN:
-			printf(((*it)->symbol.bool_value) ? "true" : "false");
-			break;
-		case Symbol::UNDEFINED:
-			printf("undefined");
-			break;
-		case Symbol::OBJECT:
-			// object as a parameter is a type violation
-			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-			// The spec makes no mention of this but
-			// TA endorsed piazza post 158 states that
-			// "undefined" must follow this error even
-			// though the type is not undefined
-			printf("undefined");
-			break;
-		case Symbol::ARRAY:
-			// Array as a parameter is a type violation
-			MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
-			printf("undefined");
-			break;
-		default:
-			MS_ERROR::report(errorReported, MS_ERROR::PARAMETER, lineNumber);
-			break;
-		}
+		writeValue((*it)->symbol, errorReported, lineNumber);
+	}
+}
+
+void writeValue(const Symbol &value, bool &errorReported, int lineNumber)
+{
+	int written = 0;
+	switch (value.type)
+	{
+	case Symbol::STRING:
+		written = fprintf(scriptOut, "%s", value.string_value.c_str());
+		break;
+	case Symbol::INTEGER:
+		written = fprintf(scriptOut, "%d", value.int_value);
+		break;
+	case Symbol::BRTAG:
+		written = fprintf(scriptOut, "\n");
+		break;
+	case Symbol::BOOLEAN:
+		written = fprintf(scriptOut, (value.bool_value) ? "true" : "false");
+		break;
+	case Symbol::UNDEFINED:
+		written = fprintf(scriptOut, "undefined");
+		break;
+	case Symbol::OBJECT:
+		// object as a parameter is a type violation
+		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+		// The spec makes no mention of this but
+		// TA endorsed piazza post 158 states that
+		// "undefined" must follow this error even
+		// though the type is not undefined
+		written = fprintf(scriptOut, "undefined");
+		break;
+	case Symbol::ARRAY:
+		// Array as a parameter is a type violation
+		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+		written = fprintf(scriptOut, "undefined");
+		break;
+	default:
+		MS_ERROR::report(errorReported, MS_ERROR::PARAMETER, lineNumber);
+		break;
 	}
+	if (written > 0)
+		metrics.add(Metrics::OUTPUT_BYTES, written);
 }
 
 void Declaration::execute(ContextPtr context)
@@ -67,6 +76,7 @@ void Declaration::execute(ContextPtr context)
 	if (expression != NULL)
 	{
 		try { expression->evaluate(context, errorReported); }
+		catch (ScriptAbort&) { throw; }
 		catch (...) {} // TODO: something...
 	}
 	dynamic_cast<Variable*>(variable)->declare(context, errorReported);
@@ -77,9 +87,11 @@ void Declaration::execute(ContextPtr context)
 	{
 		// we execute each declaration in the initializer list
 		// in the context of the object ( the objects symbol table )
-		ContextPtr objectContext = getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->object;
+		ContextPtr objectContext = heap.allocate<Context>();
+		getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->object = objectContext;
+		HeapPin<Context> pin(objectContext);
 		for (list<Statement*>::const_iterator it = object_init->begin(), end = object_init->end(); it != end; ++it)
-			(*it)->execute(objectContext);
+			(*it)->run(objectContext);
 		getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->type = Symbol::OBJECT;
 		getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->assigned = true;
 	}
@@ -90,11 +102,12 @@ void Declaration::execute(ContextPtr context)
 		for (list<Expression*>::const_iterator it = array_init->begin(), end = array_init->end(); it != end; ++it)
 		{
 			(*it)->evaluate(context, errorReported);
-			shared_ptr<Symbol> localSymbol(new Symbol());
+			Symbol* localSymbol = heap.allocateAs<Symbol>(MemStats::ARRAY);
 			// assignment
 			*localSymbol = (*it)->symbol;
+			localSymbol->share();
 			localSymbol->assigned = true;
-			getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->array.push_back(localSymbol);
+			getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->writableArray().push_back(localSymbol);
 		}
 		getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->type = Symbol::ARRAY;
 		getTableSymbol(context, dynamic_cast<Variable*>(variable)->name)->assigned = true;
@@ -105,6 +118,7 @@ void Assignment::execute(ContextPtr context)
 {
 	// evaluate the right hand side expression
 	try { expression->evaluate(context, errorReported); }
+	catch (ScriptAbort&) { throw; }
 	catch (...) {} // TODO: something...
 	dynamic_cast<Variable*>(variable)->assign(context, expression, errorReported);
 }
@@ -127,7 +141,7 @@ bool getTruth(Expression* condition, bool &errorReported)
 		break;
 	case Symbol::STRING:
 		// true is a non-empty string
-		truth = (condition->symbol.string_value != "");
+		truth = !condition->symbol.string_value.empty();
 		break;
 	default:
 		// all other types are a violation
@@ -147,6 +161,7 @@ void Conditional::execute(ContextPtr context)
 		condition->evaluate(context, errorReported);
 		truth = getTruth(condition, errorReported);
 	}
+	catch (ScriptAbort&) { throw; }
 	catch (...)
 	{
 		return; // this will cause us to just skip the conditional
@@ -155,13 +170,13 @@ void Conditional::execute(ContextPtr context)
 	{
 		/* for each Statement in the true block */
 		for (list<Statement*>::const_iterator it = ifTrue->begin(), end = ifTrue->end(); it != end; ++it)
-			(*it)->execute(context);
+			(*it)->run(context);
 	}
 	else
 	{
 		/* for each Statement in the false block */
 		for (list<Statement*>::const_iterator it = ifFalse->begin(), end = ifFalse->end(); it != end; ++it)
-			(*it)->execute(context);
+			(*it)->run(context);
 	}
 }
 
@@ -181,14 +196,18 @@ void Iterator::execute(ContextPtr context)
 			/* for each Statement in the while block */
 			for (list<Statement*>::const_iterator it = whileTrue->begin(), end = whileTrue->end(); it != end; ++it)
 			{
-				try { (*it)->execute(context); }
+				try { (*it)->run(context); }
 				catch (Break*) { return; }
 				catch (Continue*) { break; } // mind == explode
 			}
+			// loop back-edges are a safepoint
+			safepoint();
 			// re-evaluate conditional
+			currentLine = condition->lineNumber;
 			condition->evaluate(context, errorReported);
 		} while (getTruth(condition, errorReported));
 	}
+	catch (ScriptAbort&) { throw; }
 	catch (...)
 	{
 		return; // this will cause us to just skip the conditional
@@ -198,24 +217,46 @@ void Iterator::execute(ContextPtr context)
 void Function::execute(ContextPtr context)
 {
 	// make a function local context
-	ContextPtr localContext = make_shared<map<string, shared_ptr<Symbol>>>();
+	ContextPtr localContext = heap.allocateAs<Context>(MemStats::FRAME);
+	HeapFrame frame(localContext);
+	ProfileFrame profileFrame(name->c_str());
+	PerfFrame perfFrame(name->c_str());
+	CallDepth callDepth;
+	TraceScope traceScope(name->c_str(), lineNumber);
+	calls++;
 	// add arguments on the call stack to this local context
-	for (list<std::string>::reverse_iterator it = func_params->rbegin(), end = func_params->rend(); it != end; ++it)
+	for (list<const Atom*>::reverse_iterator it = func_params->rbegin(), end = func_params->rend(); it != end; ++it)
 	{
 		//FIXME: do we pass by reference or value?
-		// assume by value, so make a new symbol and fill it
-		shared_ptr<Symbol> newSymbol(new Symbol());
+		// assume by value, so make a new symbol and fill it,
+		// strings and array cells are shared until written
+		Symbol* newSymbol = heap.allocate<Symbol>();
 		*newSymbol = callStack.top()->symbol;
+		newSymbol->share();
 		newSymbol->declared = true;
 		newSymbol->assigned = true;
-		(*localContext)[(*it)] = newSymbol;
+		localContext->insert(*it, newSymbol);
 		callStack.pop();
 	}
 
+	// calls are a safepoint
+	safepoint();
+
+	// a body left for later is parsed on our first call
+	if (source)
+		parse();
+
+	// a body compiled ahead of time runs as itself
+	if (compiled)
+	{
+		compiled(localContext);
+		return;
+	}
+
 	// for each Statement in the function body
 	for (list<Statement*>::const_iterator it = body->begin(), end = body->end(); it != end; ++it)
 	{
-		(*it)->execute(localContext);
+		(*it)->run(localContext);
 		// notice we let exceptions pass up the stack
 		// this allows us to catch returns higher up
 		// and use our interpreters call stack as our
@@ -0,0 +1,192 @@
+/*
+ * CS352 Spring 2015
+ * Type feedback profiles for miniscript
+ * Andrew F. Davis
+ */
+
+#include "feedback.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+#include "runtime.hh"
+#include "snapshot.hh"
+
+using namespace std;
+
+TypeProfile typeProfile;
+
+static const char PROFILE_HEADER[] = "minijs type profile 1\n";
+/* longest function name we keep, as load() reads them with %255s */
+static const size_t MAX_NAME = 255;
+
+/* what an operation learned, as it is written in a profile */
+static const char* typeName(Symbol::Type type)
+{
+	switch (type)
+	{
+	case Symbol::STRING: return "string";
+	case Symbol::INTEGER: return "integer";
+	case Symbol::BOOLEAN: return "boolean";
+	default: return "generic";
+	}
+}
+
+static bool parseType(const char* name, Symbol::Type &type)
+{
+	static const Symbol::Type types[] = { Symbol::STRING, Symbol::INTEGER, Symbol::BOOLEAN, Symbol::UNDEFINED };
+	for (auto &it : types)
+		if (!strcmp(name, typeName(it)))
+		{
+			type = it;
+			return true;
+		}
+	return false;
+}
+
+bool TypeProfile::load(const char* path, const char* scriptPath)
+{
+	if (!hashFile(scriptPath, sourceHash))
+	{
+		fprintf(stderr, "couldn't open file for reading\n");
+		return false;
+	}
+	this->path = path;
+
+	// with no profile yet this is the run that makes one
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return true;
+
+	char line[512];
+	uint64_t hash = 0;
+	if (!fgets(line, sizeof(line), file) || strcmp(line, PROFILE_HEADER) ||
+		!fgets(line, sizeof(line), file) || sscanf(line, "source %" SCNx64, &hash) != 1)
+	{
+		fprintf(stderr, "%s is not a type profile, starting without it\n", path);
+		fclose(file);
+		return true;
+	}
+	if (hash != sourceHash)
+	{
+		fprintf(stderr, "type profile %s was made from a different script, starting without it\n", path);
+		fclose(file);
+		return true;
+	}
+
+	while (fgets(line, sizeof(line), file))
+	{
+		int lineNumber, column;
+		char name[MAX_NAME + 1];
+		unsigned long calls;
+		Symbol::Type type;
+		if (sscanf(line, "operation %d %d %255s", &lineNumber, &column, name) == 3 && parseType(name, type))
+			operations[Site(lineNumber, column)] = type;
+		else if (sscanf(line, "function %d %255s %lu", &lineNumber, name, &calls) == 3)
+			functions[lineNumber] = { name, calls };
+		else
+		{
+			fprintf(stderr, "type profile %s is corrupt, starting without it\n", path);
+			operations.clear();
+			functions.clear();
+			break;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+bool TypeProfile::save()
+{
+	// copies of an operation inlined into calls share its site,
+	// and where they disagree it is generic
+	map<Site, Symbol::Type> learned;
+	for (auto &it : seen)
+	{
+		// inference got there after all
+		if (it->provenType != Symbol::UNDEFINED)
+			continue;
+		Symbol::Type type;
+		if (it->deopts >= Operation::MAX_DEOPTS)
+			type = Symbol::UNDEFINED;
+		else if (it->quick)
+			type = it->quickType;
+		else
+			continue; // never ran, or nothing to quicken for
+		Site site(it->lineNumber, it->column);
+		auto found = learned.find(site);
+		if (found == learned.end())
+			learned[site] = type;
+		else if (found->second != type)
+			found->second = Symbol::UNDEFINED;
+	}
+	for (auto &it : learned)
+		operations[it.first] = it.second;
+
+	for (auto &it : *globalContext)
+	{
+		if (it.symbol->type != Symbol::FUNCTION || !it.symbol->function->calls)
+			continue;
+		const Function* function = it.symbol->function;
+		// too long to read back, it is just parsed lazily next time
+		if (function->getName().size() > MAX_NAME)
+			continue;
+		auto found = functions.find(function->lineNumber);
+		if (found == functions.end() || found->second.name != function->getName())
+			functions[function->lineNumber] = { function->getName(), function->calls };
+		else
+			found->second.calls += function->calls;
+	}
+
+	FILE* file = fopen(path, "w");
+	if (!file)
+	{
+		fprintf(stderr, "couldn't open %s for writing\n", path);
+		return false;
+	}
+	fputs(PROFILE_HEADER, file);
+	fprintf(file, "source %016" PRIx64 "\n", sourceHash);
+	for (auto &it : operations)
+		fprintf(file, "operation %d %d %s\n", it.first.first, it.first.second, typeName(it.second));
+	for (auto &it : functions)
+		fprintf(file, "function %d %s %lu\n", it.first, it.second.name.c_str(), it.second.calls);
+	if (fclose(file))
+	{
+		fprintf(stderr, "couldn't write type profile %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+void TypeProfile::specialize(Operation* operation)
+{
+	if (!path)
+		return;
+	seen.insert(operation);
+
+	auto found = operations.find(Site(operation->lineNumber, operation->column));
+	if (found == operations.end())
+		return;
+	if (found->second == Symbol::UNDEFINED)
+	{
+		// it gave up last time, don't have it try again
+		operation->deopts = Operation::MAX_DEOPTS;
+		return;
+	}
+	// still guarded, this run may not go the same way
+	operation->quicken(found->second);
+}
+
+void TypeProfile::parseCalled()
+{
+	for (auto &it : *globalContext)
+	{
+		if (it.symbol->type != Symbol::FUNCTION)
+			continue;
+		Function* function = it.symbol->function;
+		auto found = functions.find(function->lineNumber);
+		if (found != functions.end() && found->second.name == function->getName())
+			function->parseNow();
+	}
+}
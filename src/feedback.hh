@@ -0,0 +1,65 @@
+/*
+ * CS352 Spring 2015
+ * Type feedback profiles for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _FEEDBACK_H
+#define _FEEDBACK_H
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <set>
+#include <utility>
+
+#include "ast.hh"
+
+/*
+ * What one run of a script learned about the types flowing through it,
+ * kept for the next. Every operation static inference couldn't prove
+ * quickens itself for the operand type it sees, or gives up and stays
+ * generic; the profile keeps which, and how often each function was
+ * called. A later run loads it and starts out specialized instead of
+ * learning it all again, with the functions that were called already
+ * parsed. Operations are keyed by the line and column of their
+ * operator, so a profile is only used with the exact script it was
+ * made from.
+ */
+class TypeProfile
+{
+public:
+	/* where we load from and save to, NULL while we keep no profile */
+	const char* path = NULL;
+
+	/* keep a profile at path for this script, starting from what is
+	 * there if it was made from the same script */
+	bool load(const char* path, const char* scriptPath);
+	/* what this run learned, and what was loaded for code it didn't run */
+	bool save();
+
+	/* start an operation inference couldn't prove off as it ended up last run */
+	void specialize(Operation* operation);
+	/* parse any bodies left for later that were called last run */
+	void parseCalled();
+
+private:
+	typedef std::pair<int, int> Site;    // line and column
+
+	struct FunctionCalls {
+		std::string name;
+		unsigned long calls;
+	};
+
+	uint64_t sourceHash = 0;
+	/* operand type each operation was quickened for, UNDEFINED for generic */
+	std::map<Site, Symbol::Type> operations;
+	/* by the line they start on */
+	std::map<int, FunctionCalls> functions;
+	/* the operations of this run that may have learned something */
+	std::set<Operation*> seen;
+};
+
+extern TypeProfile typeProfile;
+
+#endif // _FEEDBACK_H
@@ -0,0 +1,195 @@
+/*
+ * CS352 Spring 2015
+ * Garbage collected heap for miniscript
+ * Andrew F. Davis
+ */
+
+#include "heap.hh"
+
+#include <cstdio>
+#include <sys/time.h>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "runtime.hh"
+
+using namespace std;
+
+static long now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+HeapRoot::HeapRoot() : prev(NULL), next(heap.roots)
+{
+	if (next)
+		next->prev = this;
+	heap.roots = this;
+}
+
+HeapRoot::~HeapRoot()
+{
+	if (prev)
+		prev->next = next;
+	else
+		heap.roots = next;
+	if (next)
+		next->prev = prev;
+}
+
+Heap::Heap() :
+	trigger(0),
+	threshold(1 << 20),
+	growth(2.0),
+	pauseBudget(0)
+{
+}
+
+Heap::~Heap()
+{
+	// the program is gone, so is everything it referenced
+	for (HeapObject* list : { objects, fresh })
+		while (list)
+		{
+			HeapObject* next = list->next;
+			release(list);
+			list = next;
+		}
+}
+
+void Heap::link(HeapObject* object, MemStats::Category category)
+{
+	object->category = category;
+	object->lineNumber = currentLine;
+	memStats.allocated(category, currentLine, object->heapSize());
+
+	// objects made while a sweep is pending are kept out of its way
+	object->next = fresh;
+	fresh = object;
+
+	stats.objectsAllocated++;
+	stats.bytesAllocated += object->heapSize();
+	stats.liveBytes += object->heapSize();
+	if (stats.liveBytes > stats.peakBytes)
+		stats.peakBytes = stats.liveBytes;
+}
+
+void Heap::release(HeapObject* object)
+{
+	unsigned char sizeClass = object->sizeClass;
+	object->~HeapObject();
+	pool.free(object, sizeClass);
+}
+
+void Heap::recordPause(long start)
+{
+	long pause = now() - start;
+	stats.totalPause += pause;
+	if (pause > stats.maxPause)
+		stats.maxPause = pause;
+}
+
+void Heap::sweep(bool finish)
+{
+	long start = now();
+	unsigned int count = 0;
+
+	while (*sweepCursor)
+	{
+		HeapObject* object = *sweepCursor;
+		if (object->marked)
+		{
+			// survivor, clear it for the next cycle
+			object->marked = false;
+			sweepCursor = &object->next;
+		}
+		else
+		{
+			*sweepCursor = object->next;
+			stats.objectsFreed++;
+			stats.bytesFreed += object->heapSize();
+			stats.liveBytes -= object->heapSize();
+			memStats.freed((MemStats::Category)object->category, object->lineNumber, object->heapSize());
+			release(object);
+		}
+
+		// check our time budget every so often
+		if (!finish && pauseBudget && !(++count % 256) && now() - start >= pauseBudget)
+			break;
+	}
+
+	if (!*sweepCursor)
+		sweepCursor = NULL;
+}
+
+void Heap::safepoint()
+{
+	if (sweepCursor)
+	{
+		// keep working through the last cycle's garbage
+		long start = now();
+		sweep(false);
+		recordPause(start);
+	}
+	else if (stats.liveBytes >= trigger && stats.liveBytes >= threshold)
+		collect();
+}
+
+void Heap::collect(bool finish)
+{
+	TraceScope traceScope("collect");
+	long start = now();
+
+	// finish off the last cycle before starting a new one
+	if (sweepCursor)
+		sweep(true);
+
+	// everything is now fair game
+	if (fresh)
+	{
+		HeapObject** tail = &fresh;
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = objects;
+		objects = fresh;
+		fresh = NULL;
+	}
+
+	// mark from the global context, the call frames and the roots
+	mark(globalContext);
+	for (auto &it : frames)
+		mark(it);
+	for (HeapRoot* root = roots; root; root = root->next)
+		root->trace(*this);
+	size_t markedBytes = 0;
+	while (!grey.empty())
+	{
+		HeapObject* object = grey.back();
+		grey.pop_back();
+		object->trace(*this);
+		markedBytes += object->heapSize();
+	}
+	stats.collections++;
+
+	// size the heap off what survived
+	trigger = markedBytes * growth;
+
+	// sweep now, or a slice at a time if we have a budget
+	sweepCursor = &objects;
+	sweep(finish);
+	recordPause(start);
+	tracer.counter("heap", stats.liveBytes);
+}
+
+void Heap::printStats(FILE* out)
+{
+	fprintf(out, "gc: %lu collections, %ld us total pause, %ld us max pause\n",
+		stats.collections, stats.totalPause, stats.maxPause);
+	fprintf(out, "gc: %lu objects (%zu bytes) allocated, %lu objects (%zu bytes) freed\n",
+		stats.objectsAllocated, stats.bytesAllocated, stats.objectsFreed, stats.bytesFreed);
+	fprintf(out, "gc: %zu bytes live, %zu bytes peak\n",
+		stats.liveBytes, stats.peakBytes);
+	pool.printStats(out);
+}
@@ -0,0 +1,190 @@
+/*
+ * CS352 Spring 2015
+ * Garbage collected heap for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _HEAP_H
+#define _HEAP_H
+
+#include <cstddef>
+#include <cstdio>
+#include <new>
+#include <vector>
+#include <utility>
+
+#include "memstats.hh"
+#include "pool.hh"
+
+class Heap;
+
+/*
+ * Base of every collected runtime object (symbols, contexts). The
+ * collector header is not part of the value, so copying an object
+ * (e.g. into an Expression's local symbol) never copies it.
+ */
+class HeapObject
+{
+	friend class Heap;
+	bool marked = false;
+	unsigned char category;    // MemStats::Category
+	unsigned char sizeClass;   // SlabPool class we were carved from
+	int lineNumber;            // script line that allocated us
+	HeapObject* next = NULL;
+public:
+	HeapObject() {}
+	HeapObject(const HeapObject&) {}
+	HeapObject& operator=(const HeapObject&) { return *this; }
+	virtual ~HeapObject() {}
+
+	/* mark every heap object we reference */
+	virtual void trace(Heap &heap) {}
+	/* bytes accounted to this object */
+	virtual size_t heapSize() const = 0;
+};
+
+/*
+ * Anything outside the heap holding references into it (the AST's
+ * local symbols, C++ locals across a safepoint) registers as a root
+ * for as long as it lives.
+ */
+class HeapRoot
+{
+	friend class Heap;
+	HeapRoot* prev;
+	HeapRoot* next;
+public:
+	HeapRoot();
+	HeapRoot(const HeapRoot&) = delete;
+	HeapRoot& operator=(const HeapRoot&) = delete;
+	virtual ~HeapRoot();
+
+	virtual void trace(Heap &heap) = 0;
+};
+
+/* pins a single C++ local for the lifetime of this guard */
+template <class T>
+class HeapPin : public HeapRoot
+{
+	T* const &object;
+public:
+	HeapPin(T* const &object) : object(object) {}
+
+	void trace(Heap &heap);
+};
+
+class Context;
+
+/*
+ * Precise mark-sweep collector. Allocation never collects; the
+ * interpreter polls safepoint() at loop back-edges, calls and
+ * between top-level statements, where every live reference is
+ * reachable from the global context, the call frames or a root.
+ */
+class Heap
+{
+	HeapObject* objects = NULL;    // swept (or being swept) objects
+	HeapObject* fresh = NULL;      // allocated since the last mark
+	HeapObject** sweepCursor = NULL;
+	HeapRoot* roots = NULL;
+	std::vector<Context*> frames;
+	std::vector<HeapObject*> grey;  // marked but not yet traced
+	size_t trigger;                // live bytes that start the next collection
+
+	/* where every object's memory comes from */
+	SlabPool pool;
+
+	void link(HeapObject* object, MemStats::Category category);
+	/* destroy an object and hand its memory back to the pool */
+	void release(HeapObject* object);
+	void sweep(bool finish);
+	void recordPause(long start);
+public:
+	/* tuning knobs */
+	size_t threshold;              // heap size below which we never collect
+	double growth;                 // next collection at live bytes times this
+	long pauseBudget;              // max microseconds of sweeping per safepoint, 0 for none
+
+	/* statistics */
+	struct Stats {
+		unsigned long collections = 0;
+		unsigned long objectsAllocated = 0;
+		unsigned long objectsFreed = 0;
+		size_t bytesAllocated = 0;
+		size_t bytesFreed = 0;
+		size_t liveBytes = 0;
+		size_t peakBytes = 0;
+		long totalPause = 0;   // microseconds
+		long maxPause = 0;     // microseconds
+	} stats;
+
+	Heap();
+	~Heap();
+
+	template <class T, class... Args>
+	T* allocate(Args&&... args)
+	{
+		return allocateAs<T>(T::CATEGORY, std::forward<Args>(args)...);
+	}
+
+	/* as above but accounted to some other category */
+	template <class T, class... Args>
+	T* allocateAs(MemStats::Category category, Args&&... args)
+	{
+		unsigned char sizeClass = SlabPool::sizeClass(sizeof(T));
+		void* memory = pool.allocate(sizeClass, sizeof(T));
+		T* object;
+		try { object = new (memory) T(std::forward<Args>(args)...); }
+		catch (...)
+		{
+			pool.free(memory, sizeClass);
+			throw;
+		}
+		object->sizeClass = sizeClass;
+		link(object, category);
+		return object;
+	}
+
+	/* flag an object live, its children are traced by collect() */
+	void mark(HeapObject* object)
+	{
+		if (object && !object->marked)
+		{
+			object->marked = true;
+			grey.push_back(object);
+		}
+	}
+
+	/* function local contexts are roots while the call is active */
+	void pushFrame(Context* frame) { frames.push_back(frame); }
+	void popFrame() { frames.pop_back(); }
+	/* for switching between scripts sharing this heap */
+	void swapFrames(std::vector<Context*> &other) { frames.swap(other); }
+
+	/* collect if we have allocated past our threshold */
+	void safepoint();
+	/* finishing the sweep too, rather than a slice at a time */
+	void collect(bool finish = false);
+
+	void printStats(FILE* out);
+
+	friend class HeapRoot;
+};
+
+extern thread_local Heap heap;
+
+template <class T>
+void HeapPin<T>::trace(Heap &heap)
+{
+	heap.mark(object);
+}
+
+/* keeps a function local context rooted while it is executing */
+class HeapFrame
+{
+public:
+	HeapFrame(Context* frame) { heap.pushFrame(frame); }
+	~HeapFrame() { heap.popFrame(); }
+};
+
+#endif // _HEAP_H
@@ -0,0 +1,507 @@
+/*
+ * CS352 Spring 2015
+ * Static type inference for miniscript
+ * Andrew F. Davis
+ */
+
+#include "runtime.hh"
+
+#include <cstdio>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "feedback.hh"
+
+using namespace std;
+
+/*
+ * Flow-sensitive inference over a program and each function body. We
+ * track which variables are proven to be assigned a primitive value of
+ * one type at each point, and from that which operations, negations and
+ * conditions can only ever see one type. Those get marked check-free.
+ *
+ * Functions can only ever write their own local context, so what we know
+ * about a scope survives calls into other functions. Any call may throw
+ * a break or continue up into our loops though, so calls flow into them,
+ * and an error out of any statement the loop doesn't catch ends it.
+ */
+class TypeEnv
+{
+public:
+	/* variables proven assigned with this primitive type */
+	map<const Atom*, Symbol::Type> types;
+	/* false once we have returned, broken out, etc. */
+	bool reachable = true;
+	/* where breaks and continues go, NULL when not in a loop */
+	TypeEnv* breaks = NULL;
+	TypeEnv* continues = NULL;
+
+	/* merge in another flow reaching the same point */
+	void join(const TypeEnv &other)
+	{
+		if (!other.reachable)
+			return;
+		if (!reachable)
+		{
+			types = other.types;
+			reachable = true;
+			return;
+		}
+		for (auto it = types.begin(); it != types.end();)
+		{
+			auto found = other.types.find(it->first);
+			if (found == other.types.end() || found->second != it->second)
+				it = types.erase(it);
+			else
+				++it;
+		}
+	}
+
+	bool operator==(const TypeEnv &other) const
+	{
+		return reachable == other.reachable && types == other.types;
+	}
+
+	Symbol::Type lookup(const Atom* name) const
+	{
+		auto found = types.find(name);
+		return (found == types.end()) ? Symbol::UNDEFINED : found->second;
+	}
+
+	/* a new flow into the same loop, nothing reaches it yet */
+	TypeEnv unreached() const
+	{
+		TypeEnv env;
+		env.reachable = false;
+		return env;
+	}
+};
+
+/* what we found out about a site that checks types at runtime */
+struct TypeSite
+{
+	int lineNumber;
+	const char* what;
+	bool proven;
+	MS_ERROR::ERROR_TYPE error;
+	bool hasError;
+};
+
+/* keyed by node, loops re-visit their bodies so the last visit wins */
+static map<const void*, TypeSite> typeSites;
+
+/* functions whose bodies we are in, copied into a call, innermost last,
+ * and how many more nodes those copies may have inlined into them */
+static vector<const Function*> inlining;
+static unsigned int inlineRoom;
+
+/* set while in the right side of an && or || that never gets there */
+static bool shortCircuited = false;
+
+static void noteSite(const void* node, int lineNumber, const char* what, bool proven)
+{
+	// a copy reports nothing the function itself doesn't,
+	// and code that can't run has no types to check
+	if (!inlining.empty() || shortCircuited)
+		return;
+	TypeSite site = { lineNumber, what, proven, MS_ERROR::TYPE, false };
+	typeSites[node] = site;
+}
+
+static void noteError(const void* node, int lineNumber, const char* what, MS_ERROR::ERROR_TYPE error)
+{
+	if (!inlining.empty() || shortCircuited)
+		return;
+	TypeSite site = { lineNumber, what, true, error, true };
+	typeSites[node] = site;
+}
+
+static bool isTruthy(Symbol::Type type)
+{
+	return type == Symbol::STRING || type == Symbol::INTEGER || type == Symbol::BOOLEAN;
+}
+
+/* an error thrown out of a statement leaves a loop just as a break
+ * does, Iterator::execute gives up on the loop on anything */
+static void mayThrow(TypeEnv &env)
+{
+	if (env.breaks)
+		env.breaks->join(env);
+}
+
+static void inferStatements(list<Statement*>* statements, TypeEnv &env)
+{
+	if (statements == NULL)
+		return;
+	for (list<Statement*>::const_iterator it = statements->begin(), end = statements->end(); it != end; ++it)
+		(*it)->infer(env);
+}
+
+static void inferCondition(Expression* condition, TypeEnv &env)
+{
+	Symbol::Type type = condition->infer(env);
+	if (type == Symbol::UNDEFINED)
+		noteSite(condition, condition->lineNumber, "condition", false);
+	else if (isTruthy(type))
+		noteSite(condition, condition->lineNumber, "condition", true);
+	else
+		noteError(condition, condition->lineNumber, "condition", MS_ERROR::CONDITION);
+}
+
+void DocumentWrite::infer(TypeEnv &env)
+{
+	for (list<Expression*>::const_iterator it = parameters->begin(), end = parameters->end(); it != end; ++it)
+		(*it)->infer(env);
+}
+
+void Declaration::infer(TypeEnv &env)
+{
+	Symbol::Type type = Symbol::UNDEFINED;
+	if (expression != NULL)
+		type = expression->infer(env);
+
+	const Atom* name = dynamic_cast<Variable*>(variable)->name;
+	// (re)declaring leaves us unassigned
+	env.types.erase(name);
+
+	if (expression != NULL)
+	{
+		// a fresh declaration can always be assigned to
+		if (isTruthy(type) || type == Symbol::BRTAG)
+			env.types[name] = type;
+	}
+	else if (object_init != NULL)
+	{
+		// members are evaluated in the object's own context,
+		// and calls in there can't get out to our loops,
+		// though an error in one still takes us with it
+		TypeEnv objectEnv;
+		objectEnv.reachable = env.reachable;
+		inferStatements(object_init, objectEnv);
+		mayThrow(env);
+	}
+	else if (array_init != NULL)
+	{
+		for (list<Expression*>::const_iterator it = array_init->begin(), end = array_init->end(); it != end; ++it)
+			(*it)->infer(env);
+		// the elements aren't guarded like an assignment is
+		mayThrow(env);
+	}
+}
+
+void Assignment::infer(TypeEnv &env)
+{
+	Symbol::Type type = expression->infer(env);
+
+	Variable* target = dynamic_cast<Variable*>(variable);
+	if (target->index != NULL)
+	{
+		// an error in the index isn't caught like one in the value
+		target->index->infer(env);
+		mayThrow(env);
+	}
+
+	// writing a member or an element doesn't change the variable
+	if (target->object_name != NULL || target->index != NULL)
+		return;
+
+	// we only know the assignment goes through if we know
+	// the variable is not an object or array already
+	if (env.lookup(target->name) == Symbol::UNDEFINED)
+		return;
+
+	if (isTruthy(type) || type == Symbol::BRTAG)
+		env.types[target->name] = type;
+	else
+		env.types.erase(target->name);
+}
+
+void Conditional::infer(TypeEnv &env)
+{
+	inferCondition(condition, env);
+
+	TypeEnv trueEnv = env;
+	inferStatements(ifTrue, trueEnv);
+	TypeEnv falseEnv = env;
+	inferStatements(ifFalse, falseEnv);
+
+	// an unknown condition skips both branches
+	if (isTruthy(condition->provenType))
+		env = trueEnv;
+	else
+		env.join(trueEnv);
+	env.join(falseEnv);
+}
+
+void Iterator::infer(TypeEnv &env)
+{
+	TypeEnv head = env;
+	TypeEnv breakEnv = env.unreached();
+
+	// iterate until what reaches the top of the loop settles
+	for (;;)
+	{
+		inferCondition(condition, head);
+
+		TypeEnv body = head;
+		breakEnv = env.unreached();
+		TypeEnv continueEnv = env.unreached();
+		body.breaks = &breakEnv;
+		body.continues = &continueEnv;
+		inferStatements(whileTrue, body);
+		body.join(continueEnv);
+
+		TypeEnv next = env;
+		next.join(body);
+		if (next == head)
+			break;
+		head = next;
+	}
+
+	// we leave when the condition fails (or can't be
+	// decided) or on a break, a return or an error
+	// inside a loop is also caught here by Iterator::execute
+	TypeEnv exitEnv = head;
+	exitEnv.join(breakEnv);
+	exitEnv.breaks = env.breaks;
+	exitEnv.continues = env.continues;
+	env = exitEnv;
+}
+
+void Function::infer(TypeEnv &env)
+{
+	// a function body is its own scope, its parameters
+	// can be anything and globals can change between calls
+	TypeEnv local;
+	inferStatements(body, local);
+}
+
+void Call::infer(TypeEnv &env)
+{
+	callable->infer(env);
+}
+
+void Break::infer(TypeEnv &env)
+{
+	if (env.breaks)
+		env.breaks->join(env);
+	env.reachable = false;
+}
+
+void Continue::infer(TypeEnv &env)
+{
+	if (env.continues)
+		env.continues->join(env);
+	env.reachable = false;
+}
+
+void Return::infer(TypeEnv &env)
+{
+	ret->infer(env);
+	// Iterator::execute swallows a return like a break
+	if (env.breaks)
+		env.breaks->join(env);
+	env.reachable = false;
+}
+
+Symbol::Type Variable::infer(TypeEnv &env)
+{
+	if (index != NULL)
+		index->infer(env);
+	if (object_name != NULL || index != NULL)
+		return provenType = Symbol::UNDEFINED;
+	return provenType = env.lookup(name);
+}
+
+/* if the left side is a constant that decides an && or || on its own */
+static bool decidedByLeft(Operation::OpType opType, Expression* left)
+{
+	if ((opType != Operation::AND && opType != Operation::OR) ||
+		!dynamic_cast<Constant*>(left) || !isTruthy(left->symbol.type))
+		return false;
+	bool errorReported = false;
+	return getTruth(left, errorReported) == (opType == Operation::OR);
+}
+
+Symbol::Type Operation::infer(TypeEnv &env)
+{
+	Symbol::Type leftType = left->infer(env);
+	bool decided = decidedByLeft(opType, left);
+	bool outerShortCircuited = shortCircuited;
+	shortCircuited |= decided;
+	Symbol::Type rightType = right->infer(env);
+	shortCircuited = outerShortCircuited;
+
+	// forget anything we decided on an earlier visit
+	quick = NULL;
+	provenType = Symbol::UNDEFINED;
+
+	if (decided)
+	{
+		// shortCircuit() gives back the left side's truth
+		noteSite(this, lineNumber, "operation", true);
+		return provenType = Symbol::BOOLEAN;
+	}
+
+	if (leftType == Symbol::UNDEFINED || rightType == Symbol::UNDEFINED)
+	{
+		noteSite(this, lineNumber, "operation", false);
+		// what we can't prove a profile from an earlier run may know
+		typeProfile.specialize(this);
+		return provenType;
+	}
+
+	if (leftType == rightType && resultType(opType, leftType) != Symbol::UNDEFINED)
+	{
+		// both sides are known and we have a native version
+		quicken(leftType, false);
+		noteSite(this, lineNumber, "operation", true);
+		return provenType = resultType(opType, leftType);
+	}
+
+	if ((opType == Operation::AND || opType == Operation::OR) &&
+		isTruthy(leftType) && isTruthy(rightType))
+	{
+		// mixed types get compared on truthiness
+		noteSite(this, lineNumber, "operation", true);
+		return provenType = Symbol::BOOLEAN;
+	}
+
+	// short-circuiting needs the truth of the left side first
+	if ((opType == Operation::AND || opType == Operation::OR) && !isTruthy(leftType))
+		noteError(this, lineNumber, "operation", MS_ERROR::CONDITION);
+	else
+		noteError(this, lineNumber, "operation", MS_ERROR::TYPE);
+	return provenType;
+}
+
+Symbol::Type Negate::infer(TypeEnv &env)
+{
+	Symbol::Type type = right->infer(env);
+
+	checked = !isTruthy(type);
+	provenType = Symbol::UNDEFINED;
+	if (type == Symbol::UNDEFINED)
+		noteSite(this, lineNumber, "negation", false);
+	else if (isTruthy(type))
+	{
+		noteSite(this, lineNumber, "negation", true);
+		provenType = Symbol::BOOLEAN;
+	}
+	else
+		noteError(this, lineNumber, "negation", MS_ERROR::TYPE);
+	return provenType;
+}
+
+/* copy in the function a call names, if we may, see inline.cc */
+static void inlineCall(Callable* call)
+{
+	unsigned int room = inlining.empty() ? inlineBudget : inlineRoom;
+	Symbol* tableSymbol = globalContext->find(call->name);
+	if (room == 0 || tableSymbol == NULL || tableSymbol->type != Symbol::FUNCTION)
+		return;
+	for (auto &it : inlining)
+		if (it == tableSymbol->function)
+			return;
+	call->inlineFunction(tableSymbol->function, room);
+}
+
+Symbol::Type Callable::infer(TypeEnv &env)
+{
+	for (list<Expression*>::const_iterator it = parameters->begin(), end = parameters->end(); it != end; ++it)
+		(*it)->infer(env);
+
+	// a small function we call is copied in on our first visit
+	if (inlined == NULL)
+		inlineCall(this);
+
+	// its copy knows the types of our arguments, but starts out
+	// knowing nothing else, just as the function itself does
+	if (inlined != NULL)
+	{
+		TypeEnv local;
+		unsigned int outerRoom = inlineRoom;
+		inlineRoom = (inlining.empty() ? inlineBudget : inlineRoom) - inlinedSize;
+		inlining.push_back(inlinedFunction);
+		inlined->infer(local);
+		inlining.pop_back();
+		inlineRoom = outerRoom;
+	}
+
+	// the function may break or continue our loops for us
+	if (env.breaks)
+		env.breaks->join(env);
+	if (env.continues)
+		env.continues->join(env);
+
+	// we know nothing about what comes back
+	return provenType = Symbol::UNDEFINED;
+}
+
+void inferFunction(Function* function)
+{
+	TypeEnv env;
+	function->infer(env);
+	// nobody asks for a report on these
+	typeSites.clear();
+}
+
+void inferTypes(list<Statement*>* program, bool report)
+{
+	if (program == NULL)
+		return;
+
+	typeSites.clear();
+
+	TypeEnv env;
+	for (list<Statement*>::const_iterator it = program->begin(), end = program->end(); it != end; ++it)
+	{
+		// runProgram() catches a stray break or continue
+		// and moves on to the next statement
+		TypeEnv stray = env.unreached();
+		env.breaks = &stray;
+		env.continues = &stray;
+		(*it)->infer(env);
+		env.join(stray);
+		env.breaks = NULL;
+		env.continues = NULL;
+		// a top-level return never comes back
+		if (!env.reachable)
+			break;
+	}
+
+	// function bodies are registered globally
+	for (auto &it : *globalContext)
+		if (it.symbol->type == Symbol::FUNCTION)
+			it.symbol->function->infer(env);
+
+	if (!report)
+		return;
+
+	vector<TypeSite> sites;
+	for (auto &it : typeSites)
+		sites.push_back(it.second);
+	stable_sort(sites.begin(), sites.end(),
+		[](const TypeSite &a, const TypeSite &b) { return a.lineNumber < b.lineNumber; });
+
+	// errors we can prove come out first, as they would at runtime
+	unsigned int proven = 0;
+	for (auto &it : sites)
+	{
+		if (it.hasError)
+		{
+			bool errorReported = false;
+			MS_ERROR::report(errorReported, it.error, it.lineNumber);
+		}
+		if (it.proven)
+			proven++;
+	}
+
+	for (auto &it : sites)
+		if (!it.proven)
+			fprintf(stderr, "types: line %d, dynamic %s\n", it.lineNumber, it.what);
+	fprintf(stderr, "types: %u of %zu sites proven\n", proven, sites.size());
+}
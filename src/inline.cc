@@ -0,0 +1,208 @@
+/*
+ * CS352 Spring 2015
+ * Call inlining for miniscript
+ * Andrew F. Davis
+ */
+
+#include "runtime.hh"
+
+#include <vector>
+
+#include "miniscript.hh"
+#include "ast.hh"
+
+using namespace std;
+
+/*
+ * A function whose body is a lone return of a small expression gets
+ * that expression copied into each call to it as types are inferred,
+ * its parameters replaced with the call's arguments. The copy runs in
+ * the global context, where its other names resolve just as they do
+ * from a frame holding only the parameters, and keeps the function's
+ * line numbers. A call only runs the copy while its name still means
+ * the function it was copied from.
+ *
+ * Each copy has values and reported errors of its own, where the
+ * function's one body shares them between every call. A call that
+ * leaves a value unset or reports an error can then print or compute
+ * something else than it would through the function, so this is off
+ * unless asked for.
+ *
+ * Functions that call themselves are left alone, a call in a copy is
+ * inlined in turn only from what room the budget has left, and never
+ * with a function already being inlined around it.
+ */
+
+unsigned int inlineBudget = 0;
+
+/* what we need while copying a function body into a call */
+struct InlineCopy
+{
+	Function* function;
+	Callable* call;
+	/* the call's arguments, one for each parameter */
+	vector<Expression*> arguments;
+	unsigned int room;
+	unsigned int size;
+};
+
+Return* Function::onlyReturn() const
+{
+	// a body left for later can't be looked into yet
+	if (body == NULL || body->size() != 1)
+		return NULL;
+	return dynamic_cast<Return*>(body->front());
+}
+
+static int parameterIndex(const InlineCopy &copy, const Atom* name)
+{
+	int index = 0;
+	for (auto &it : *copy.function->getParams())
+	{
+		if (it == name)
+			return index;
+		index++;
+	}
+	return -1;
+}
+
+static Expression* copyExpression(Expression* expression, InlineCopy &copy);
+
+static list<Expression*>* copyList(list<Expression*>* expressions, InlineCopy &copy)
+{
+	list<Expression*>* result = new list<Expression*>();
+	for (auto &it : *expressions)
+	{
+		Expression* expression = copyExpression(it, copy);
+		if (!expression)
+		{
+			for (auto &done : *result) delete done;
+			delete result;
+			return NULL;
+		}
+		result->push_back(expression);
+	}
+	return result;
+}
+
+/* a copy of the expression for our call, NULL if it can't be inlined */
+static Expression* copyExpression(Expression* expression, InlineCopy &copy)
+{
+	if (++copy.size > copy.room)
+		return NULL;
+
+	if (Constant* constant = dynamic_cast<Constant*>(expression))
+	{
+		Constant* result = new Constant(constant->lineNumber);
+		result->symbol = constant->symbol;
+		return result;
+	}
+
+	if (Variable* variable = dynamic_cast<Variable*>(expression))
+	{
+		int parameter = parameterIndex(copy, variable->name);
+		if (parameter >= 0)
+		{
+			// only the parameter itself, an element or member
+			// of it would need it copied into a frame
+			if (variable->index != NULL || variable->object_name != NULL)
+				return NULL;
+			return new InlineArgument(copy.arguments[parameter],
+				&copy.call->inlinedValues[parameter], variable->lineNumber);
+		}
+		if (variable->object_name != NULL)
+			return new Variable(variable->name, variable->object_name, variable->lineNumber);
+		if (variable->index != NULL)
+		{
+			Expression* index = copyExpression(variable->index, copy);
+			if (!index)
+				return NULL;
+			return new Variable(variable->name, index, variable->lineNumber);
+		}
+		return new Variable(variable->name, variable->lineNumber);
+	}
+
+	if (Operation* operation = dynamic_cast<Operation*>(expression))
+	{
+		Expression* left = copyExpression(operation->left, copy);
+		if (!left)
+			return NULL;
+		Expression* right = copyExpression(operation->right, copy);
+		if (!right)
+		{
+			delete left;
+			return NULL;
+		}
+		return new Operation(operation->opType, left, right, operation->lineNumber, operation->column);
+	}
+
+	if (Negate* negate = dynamic_cast<Negate*>(expression))
+	{
+		Expression* right = copyExpression(negate->right, copy);
+		if (!right)
+			return NULL;
+		return new Negate(right, negate->lineNumber);
+	}
+
+	if (Callable* callable = dynamic_cast<Callable*>(expression))
+	{
+		// no recursion, and a parameter can't be called
+		if (callable->name->text == copy.function->getName() ||
+			parameterIndex(copy, callable->name) >= 0)
+			return NULL;
+		list<Expression*>* parameters = copyList(callable->parameters, copy);
+		if (!parameters)
+			return NULL;
+		return new Callable(callable->name, parameters, callable->lineNumber);
+	}
+
+	return NULL;
+}
+
+bool Callable::inlineFunction(Function* function, unsigned int room)
+{
+	Return* ret = function->onlyReturn();
+	if (!ret || parameters->size() != function->getNumberOfArgs())
+		return false;
+
+	InlineCopy copy = { function, this, vector<Expression*>(parameters->begin(), parameters->end()), room, 0 };
+	// sized once, the copy points into it
+	inlinedValues.assign(parameters->size(), Symbol());
+	Expression* body = copyExpression(ret->getValue(), copy);
+	if (!body)
+	{
+		inlinedValues.clear();
+		return false;
+	}
+
+	inlined = body;
+	inlinedFunction = function;
+	inlinedReturn = ret;
+	inlinedSize = copy.size;
+	return true;
+}
+
+void Callable::trace(Heap &heap)
+{
+	symbol.trace(heap);
+	for (auto &it : inlinedValues)
+		it.trace(heap);
+}
+
+InlineArgument::InlineArgument(Expression* argument, const Symbol* value, int lineNumber) :
+	Expression(lineNumber), argument(argument), value(value)
+{
+	rdprintf("InlineArgument: %d\n", lineNumber);
+}
+
+void InlineArgument::evaluate(ContextPtr context, bool &errorReported)
+{
+	// just as for a parameter by name, an object or
+	// array can't be used by itself
+	if (value->type == Symbol::OBJECT || value->type == Symbol::ARRAY)
+	{
+		MS_ERROR::report(errorReported, MS_ERROR::TYPE, lineNumber);
+		return;
+	}
+	symbol = *value;
+}
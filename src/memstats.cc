@@ -0,0 +1,111 @@
+/*
+ * CS352 Spring 2015
+ * Memory accounting for miniscript
+ * Andrew F. Davis
+ */
+
+#include "memstats.hh"
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+MemStats memStats;
+
+static const char* categoryNames[MemStats::CATEGORIES] = {
+	"ast",
+	"context",
+	"frame",
+	"symbol",
+	"array",
+	"string",
+};
+
+/* how many of the busiest lines we list */
+static const unsigned int REPORT_LINES = 20;
+
+void MemStats::Counter::add(size_t bytes)
+{
+	liveBytes += bytes;
+	totalBytes += bytes;
+	liveCount++;
+	totalCount++;
+	if (liveBytes > peakBytes)
+		peakBytes = liveBytes;
+	if (liveCount > peakCount)
+		peakCount = liveCount;
+}
+
+void MemStats::Counter::remove(size_t bytes)
+{
+	liveBytes -= bytes;
+	liveCount--;
+}
+
+void MemStats::record(Category category, int lineNumber, size_t bytes)
+{
+	categories[category].add(bytes);
+	lines[lineNumber].add(bytes);
+}
+
+void MemStats::release(Category category, int lineNumber, size_t bytes)
+{
+	categories[category].remove(bytes);
+	// a line of zero means we don't know where it came from
+	if (lineNumber)
+		lines[lineNumber].remove(bytes);
+}
+
+void MemStats::poll(FILE* out)
+{
+	if (reportRequested)
+	{
+		reportRequested = 0;
+		print(out);
+	}
+}
+
+static void printCounter(FILE* out, const char* name, const MemStats::Counter &counter)
+{
+	fprintf(out, "mem: %-10s %12zu %12zu %12zu %10lu %10lu %10lu\n", name,
+		counter.liveBytes, counter.peakBytes, counter.totalBytes,
+		counter.liveCount, counter.peakCount, counter.totalCount);
+}
+
+void MemStats::print(FILE* out)
+{
+	fprintf(out, "mem: %-10s %12s %12s %12s %10s %10s %10s\n", "category",
+		"live bytes", "peak bytes", "total bytes", "live", "peak", "total");
+
+	Counter total;
+	for (int i = 0; i < CATEGORIES; i++)
+	{
+		printCounter(out, categoryNames[i], categories[i]);
+		total.liveBytes += categories[i].liveBytes;
+		total.peakBytes += categories[i].peakBytes;
+		total.totalBytes += categories[i].totalBytes;
+		total.liveCount += categories[i].liveCount;
+		total.peakCount += categories[i].peakCount;
+		total.totalCount += categories[i].totalCount;
+	}
+	// note: the peak of the total is the sum of the peaks
+	printCounter(out, "total", total);
+
+	// the lines that allocated the most, in line order
+	vector<pair<int, Counter>> busiest(lines.begin(), lines.end());
+	sort(busiest.begin(), busiest.end(),
+		[](const pair<int, Counter> &a, const pair<int, Counter> &b) { return a.second.totalBytes > b.second.totalBytes; });
+	if (busiest.size() > REPORT_LINES)
+		busiest.resize(REPORT_LINES);
+	sort(busiest.begin(), busiest.end(),
+		[](const pair<int, Counter> &a, const pair<int, Counter> &b) { return a.first < b.first; });
+
+	for (auto &it : busiest)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "line %d", it.first);
+		printCounter(out, name, it.second);
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * CS352 Spring 2015
+ * Memory accounting for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _MEMSTATS_H
+#define _MEMSTATS_H
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+
+class MemStats
+{
+public:
+	enum Category {
+		AST,
+		CONTEXT,
+		FRAME,
+		SYMBOL,
+		ARRAY,
+		STRING,
+		CATEGORIES
+	};
+
+	struct Counter {
+		size_t liveBytes = 0;
+		size_t peakBytes = 0;
+		size_t totalBytes = 0;
+		unsigned long liveCount = 0;
+		unsigned long peakCount = 0;
+		unsigned long totalCount = 0;
+
+		void add(size_t bytes);
+		void remove(size_t bytes);
+	};
+
+	/* nothing is counted unless we are asked to */
+	bool enabled = false;
+
+	Counter categories[CATEGORIES];
+	/* keyed by the script line that did the allocating */
+	std::map<int, Counter> lines;
+
+	void allocated(Category category, int lineNumber, size_t bytes)
+	{
+		if (enabled)
+			record(category, lineNumber, bytes);
+	}
+	void freed(Category category, int lineNumber, size_t bytes)
+	{
+		if (enabled)
+			release(category, lineNumber, bytes);
+	}
+
+	/* a report asked for from outside, printed at the next safepoint */
+	void requestReport() { reportRequested = 1; }
+	void poll(FILE* out);
+
+	void print(FILE* out);
+
+private:
+	volatile int reportRequested = 0;
+
+	void record(Category category, int lineNumber, size_t bytes);
+	void release(Category category, int lineNumber, size_t bytes);
+};
+
+extern MemStats memStats;
+
+#endif // _MEMSTATS_H
@@ -0,0 +1,138 @@
+/*
+ * CS352 Spring 2015
+ * Live runtime metrics for miniscript
+ * Andrew F. Davis
+ */
+
+#include "metrics.hh"
+
+#include <mutex>
+
+using namespace std;
+
+const char* const Metrics::names[COUNTERS] = {
+	"statements",
+	"calls",
+	"contexts",
+	"lookups",
+	"lookup_misses",
+	"array_resizes",
+	"output_bytes",
+	"call_depth",
+};
+
+thread_local Metrics metrics;
+
+bool metricsJSON = false;
+
+static atomic<int> dumpRequested(0);
+
+/* every thread's counters, and what threads that have exited counted */
+static mutex registryLock;
+static vector<Metrics*> &registry()
+{
+	static vector<Metrics*>* live = new vector<Metrics*>;
+	return *live;
+}
+static MetricValues retired;
+
+/* lists a thread's counters while it lives, then keeps what they came to */
+class MetricsLink
+{
+public:
+	MetricsLink()
+	{
+		lock_guard<mutex> lock(registryLock);
+		registry().push_back(&metrics);
+	}
+	~MetricsLink()
+	{
+		lock_guard<mutex> lock(registryLock);
+		vector<Metrics*> &live = registry();
+		for (auto it = live.begin(); it != live.end(); ++it)
+			if (*it == &metrics)
+			{
+				live.erase(it);
+				break;
+			}
+		for (int i = 0; i < Metrics::COUNTERS; i++)
+			retired.counts[i] += metrics.get((Metrics::Counter)i);
+	}
+};
+
+void Metrics::attach()
+{
+	static thread_local MetricsLink link;
+	(void)link;
+}
+
+MetricsReport readMetrics()
+{
+	MetricsReport report;
+	lock_guard<mutex> lock(registryLock);
+	report.total = retired;
+	for (auto &it : registry())
+	{
+		MetricValues values;
+		for (int i = 0; i < Metrics::COUNTERS; i++)
+		{
+			values.counts[i] = it->get((Metrics::Counter)i);
+			report.total.counts[i] += values.counts[i];
+		}
+		report.threads.push_back(values);
+	}
+	return report;
+}
+
+static void printValues(FILE* out, const MetricValues &values, bool json)
+{
+	for (int i = 0; i < Metrics::COUNTERS; i++)
+		if (json)
+			fprintf(out, "%s\"%s\":%llu", i ? "," : "", Metrics::names[i],
+				(unsigned long long)values.counts[i]);
+		else
+			fprintf(out, " %s=%llu", Metrics::names[i], (unsigned long long)values.counts[i]);
+}
+
+void MetricsReport::print(FILE* out, bool json) const
+{
+	if (json)
+	{
+		fprintf(out, "{\"total\":{");
+		printValues(out, total, true);
+		fprintf(out, "},\"threads\":[");
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			fprintf(out, "%s{", i ? "," : "");
+			printValues(out, threads[i], true);
+			fprintf(out, "}");
+		}
+		fprintf(out, "]}\n");
+		return;
+	}
+
+	fprintf(out, "metrics: total");
+	printValues(out, total, false);
+	fprintf(out, "\n");
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		fprintf(out, "metrics: thread %zu", i);
+		printValues(out, threads[i], false);
+		fprintf(out, "\n");
+	}
+}
+
+void requestMetricsDump()
+{
+	dumpRequested.store(1, memory_order_relaxed);
+}
+
+void pollMetrics()
+{
+	// whichever thread gets here first reports for them all
+	if (dumpRequested.load(memory_order_relaxed) && dumpRequested.exchange(0))
+	{
+		readMetrics().print(stderr, metricsJSON);
+		fflush(stderr);
+	}
+}
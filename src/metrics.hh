@@ -0,0 +1,98 @@
+/*
+ * CS352 Spring 2015
+ * Live runtime metrics for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+/*
+ * Counters every interpreter thread keeps as it runs, always on.
+ * Each thread only ever writes its own, so bumping one is a plain
+ * load and store; they are atomic only so any other thread can read
+ * them at any time, for a dump or a host asking how things are.
+ * They need no constructing, so using them costs no more than any
+ * other thread local, and each thread attaches them to the list the
+ * readers go through once it starts interpreting.
+ */
+class Metrics
+{
+public:
+	enum Counter {
+		STATEMENTS,
+		CALLS,              // script functions and natives
+		CONTEXTS,           // symbol tables made, frames and objects too
+		LOOKUPS,            // names looked up in a symbol table
+		LOOKUP_MISSES,      // those that weren't there yet
+		ARRAY_RESIZES,      // arrays grown or changing representation
+		OUTPUT_BYTES,       // written by document.write
+		CALL_DEPTH,         // functions active right now
+		COUNTERS
+	};
+
+	static const char* const names[COUNTERS];
+
+	Metrics() = default;
+	Metrics(const Metrics&) = delete;
+	Metrics& operator=(const Metrics&) = delete;
+
+	/* let readMetrics see this thread's counters, until it exits */
+	void attach();
+
+	void add(Counter counter, uint64_t amount = 1)
+	{
+		counts[counter].store(counts[counter].load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+	void remove(Counter counter, uint64_t amount = 1)
+	{
+		counts[counter].store(counts[counter].load(std::memory_order_relaxed) - amount, std::memory_order_relaxed);
+	}
+	uint64_t get(Counter counter) const { return counts[counter].load(std::memory_order_relaxed); }
+	void set(Counter counter, uint64_t value) { counts[counter].store(value, std::memory_order_relaxed); }
+
+private:
+	/* zero, as for anything thread local with no initializer */
+	std::atomic<uint64_t> counts[COUNTERS];
+};
+
+extern thread_local Metrics metrics;
+
+/* the counters at one moment, of one thread or all of them */
+struct MetricValues
+{
+	uint64_t counts[Metrics::COUNTERS] = {};
+};
+
+struct MetricsReport
+{
+	/* threads gone by are in the totals, but have no entry of their own */
+	MetricValues total;
+	std::vector<MetricValues> threads;
+
+	/* "name value" lines, or a single JSON object */
+	void print(FILE* out, bool json) const;
+};
+
+/* what every interpreter thread has counted so far */
+MetricsReport readMetrics();
+
+/* a dump asked for from outside (SIGUSR1), written at the next safepoint */
+void requestMetricsDump();
+void pollMetrics();
+extern bool metricsJSON;
+
+/* counts a function call while it is active */
+class CallDepth
+{
+public:
+	CallDepth() { metrics.add(Metrics::CALLS); metrics.add(Metrics::CALL_DEPTH); }
+	~CallDepth() { metrics.remove(Metrics::CALL_DEPTH); }
+};
+
+#endif // _METRICS_H
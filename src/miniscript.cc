@@ -6,24 +6,208 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <fstream>
+#include <iostream>
 
 #include "miniscript.hh"
 #include "ast.hh"
 #include "runtime.hh"
+#include "snapshot.hh"
+#include "server.hh"
+#include "batch.hh"
+#include "datafiles.hh"
+#include "emitcpp.hh"
+#include "feedback.hh"
 
 extern FILE *yyin;
 int yyparse(std::list<Statement*>* &program);
 
-void yyerror(std::list<Statement*>* &program, const char * s)
+static void usage(const char* name)
 {
-	fprintf(stderr, "%s\n", s);
-	exit(1); /* just end here */
+	fprintf(stderr, "usage: %s [options] file\n", name);
+	fprintf(stderr, "       %s [options] --serve=SOCKET\n", name);
+	fprintf(stderr, "       %s [options] --batch=RECORDS file\n", name);
+	fprintf(stderr, "  --check-types       report type errors proven before running, and unproven sites\n");
+	fprintf(stderr, "  --lazy-functions    parse function bodies on their first call, syntax errors in them show up then\n");
+	fprintf(stderr, "  --inline-budget=N   copy functions that only return an expression of up to N nodes\n");
+	fprintf(stderr, "                      into their calls (default 0, off: a copy's errors and stale values\n");
+	fprintf(stderr, "                      are its own, so output can differ from the uninlined call)\n");
+	fprintf(stderr, "  --gc-stats          print garbage collector statistics at exit\n");
+	fprintf(stderr, "  --gc-heap=BYTES     heap size below which we never collect\n");
+	fprintf(stderr, "  --gc-growth=FACTOR  grow the heap to live size times this after a collection\n");
+	fprintf(stderr, "  --gc-pause=USEC     sweep at most this long per safepoint\n");
+	fprintf(stderr, "  --max-steps=N       stop the script after this many statements\n");
+	fprintf(stderr, "  --timeout=MSEC      stop the script after this much wall-clock time\n");
+	fprintf(stderr, "  --max-heap=BYTES    stop the script if its live heap grows past this\n");
+	fprintf(stderr, "  --sample=HZ         sample the script call stack this many times a second\n");
+	fprintf(stderr, "  --sample-out=FILE   write folded stacks here (default minijs.folded)\n");
+	fprintf(stderr, "  --perf-counters     count cycles, instructions, cache and branch misses per function\n");
+	fprintf(stderr, "                      and top-level statement, printed at exit\n");
+	fprintf(stderr, "  --snapshot=FILE     save the globals here once --snapshot-at is reached\n");
+	fprintf(stderr, "  --snapshot-at=LINE  the first top-level statement at or past this line\n");
+	fprintf(stderr, "  --restore=FILE      load a snapshot of this script and carry on from where it was taken\n");
+	fprintf(stderr, "                      (the snapshot options and --mem-stats only work on a single run)\n");
+	fprintf(stderr, "  --serve=SOCKET      run scripts for minijs-client on this Unix domain socket\n");
+	fprintf(stderr, "                      (this and --batch don't take --check-types, --sample, --perf-counters or --emit-cpp)\n");
+	fprintf(stderr, "  --batch=RECORDS     run the script once per line of RECORDS (- for stdin), a JSON\n");
+	fprintf(stderr, "                      object or key=value pairs giving the globals it starts with\n");
+	fprintf(stderr, "  --workers=N         threads to run scripts on when serving or batching (default one per CPU)\n");
+	fprintf(stderr, "  --slice=USEC        time each script runs before the next on its thread (default 2000)\n");
+	fprintf(stderr, "  --mem-stats         print memory use by category and line at exit, or on SIGUSR2\n");
+	fprintf(stderr, "  --metrics=FORMAT    runtime counters printed on SIGUSR1 as text (default) or json\n");
+	fprintf(stderr, "  --trace=FILE        write a Chrome trace-event timeline of the run here\n");
+	fprintf(stderr, "  --data-dir=DIR      where loadInts, loadLines, saveInts and saveLines find their files,\n");
+	fprintf(stderr, "                      scripts can't touch any files without it\n");
+	fprintf(stderr, "  --emit-cpp=FILE     write the script out as C++ (- for stdout) instead of running it,\n");
+	fprintf(stderr, "                      to build against the minijs-runtime library\n");
+	fprintf(stderr, "  --type-profile=FILE start from the types this script saw last run, kept in FILE,\n");
+	fprintf(stderr, "                      and save what this run sees there (not when serving or batching)\n");
+}
+
+static void stopTrace(const char* path)
+{
+	if (!path)
+		return;
+	tracer.stop();
+	fprintf(stderr, "trace: %lu events (%lu dropped) written to %s\n",
+		tracer.written, tracer.dropped, path);
+}
+
+static void memStatsSignal(int)
+{
+	memStats.requestReport();
+}
+
+static void metricsSignal(int)
+{
+	requestMetricsDump();
 }
 
 int main(int argc, char *argv[])
 {
+	bool gcStats = false;
+	bool checkTypes = false;
+	const char* restorePath = NULL;
+	const char* servePath = NULL;
+	const char* batchPath = NULL;
+	unsigned int workers = 0;
+	long slice = 2000;
+	unsigned int sampleRate = 0;
+	const char* sampleOut = "minijs.folded";
+	bool countPerf = false;
+	const char* tracePath = NULL;
+	const char* emitPath = NULL;
+	const char* profilePath = NULL;
+
+	/* Handle options */
+	int arg = 1;
+	for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++)
+	{
+		if (!strcmp(argv[arg], "--check-types"))
+			checkTypes = true;
+		else if (!strcmp(argv[arg], "--lazy-functions"))
+			lazyFunctions = true;
+		else if (!strncmp(argv[arg], "--inline-budget=", 16))
+			inlineBudget = strtoul(argv[arg] + 16, NULL, 0);
+		else if (!strcmp(argv[arg], "--gc-stats"))
+			gcStats = true;
+		else if (!strncmp(argv[arg], "--gc-heap=", 10))
+			heap.threshold = strtoul(argv[arg] + 10, NULL, 0);
+		else if (!strncmp(argv[arg], "--gc-growth=", 12))
+			heap.growth = strtod(argv[arg] + 12, NULL);
+		else if (!strncmp(argv[arg], "--gc-pause=", 11))
+			heap.pauseBudget = strtol(argv[arg] + 11, NULL, 0);
+		else if (!strncmp(argv[arg], "--max-steps=", 12))
+			limits.fuel = strtoul(argv[arg] + 12, NULL, 0);
+		else if (!strncmp(argv[arg], "--timeout=", 10))
+			limits.timeout = strtol(argv[arg] + 10, NULL, 0);
+		else if (!strncmp(argv[arg], "--max-heap=", 11))
+			limits.heapQuota = strtoul(argv[arg] + 11, NULL, 0);
+		else if (!strncmp(argv[arg], "--sample=", 9))
+			sampleRate = strtoul(argv[arg] + 9, NULL, 0);
+		else if (!strncmp(argv[arg], "--sample-out=", 13))
+			sampleOut = argv[arg] + 13;
+		else if (!strcmp(argv[arg], "--perf-counters"))
+			countPerf = true;
+		else if (!strncmp(argv[arg], "--snapshot=", 11))
+			snapshot.savePath = argv[arg] + 11;
+		else if (!strncmp(argv[arg], "--snapshot-at=", 14))
+			snapshot.saveLine = strtol(argv[arg] + 14, NULL, 0);
+		else if (!strncmp(argv[arg], "--restore=", 10))
+			restorePath = argv[arg] + 10;
+		else if (!strncmp(argv[arg], "--serve=", 8))
+			servePath = argv[arg] + 8;
+		else if (!strncmp(argv[arg], "--batch=", 8))
+			batchPath = argv[arg] + 8;
+		else if (!strncmp(argv[arg], "--workers=", 10))
+			workers = strtoul(argv[arg] + 10, NULL, 0);
+		else if (!strncmp(argv[arg], "--slice=", 8))
+			slice = strtol(argv[arg] + 8, NULL, 0);
+		else if (!strcmp(argv[arg], "--mem-stats"))
+			memStats.enabled = true;
+		else if (!strcmp(argv[arg], "--metrics=json") || !strcmp(argv[arg], "--metrics=text"))
+			metricsJSON = !strcmp(argv[arg] + 10, "json");
+		else if (!strncmp(argv[arg], "--trace=", 8))
+			tracePath = argv[arg] + 8;
+		else if (!strncmp(argv[arg], "--data-dir=", 11))
+			dataDirectory = argv[arg] + 11;
+		else if (!strncmp(argv[arg], "--emit-cpp=", 11))
+			emitPath = argv[arg] + 11;
+		else if (!strncmp(argv[arg], "--type-profile=", 15))
+			profilePath = argv[arg] + 15;
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	/* Memory stats, snapshots, profiles, samples, perf counters, type
+	 * reports and emitting are all for a single run, not for workers */
+	if ((servePath || batchPath) &&
+		(memStats.enabled || snapshot.savePath || snapshot.saveLine || restorePath ||
+		profilePath || sampleRate || countPerf || checkTypes || emitPath))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	/* Counters are always kept, dumped at the next safepoint on demand */
+	signal(SIGUSR1, metricsSignal);
+	if (tracePath && !tracer.start(tracePath))
+	{
+		fprintf(stderr, "couldn't open %s for writing\n", tracePath);
+		return 1;
+	}
+	if (servePath)
+	{
+		int status = serve(servePath, workers, slice, limits);
+		stopTrace(tracePath);
+		return status;
+	}
+	if (arg >= argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (batchPath)
+	{
+		int status = runBatch(argv[arg], batchPath, workers, limits);
+		stopTrace(tracePath);
+		return status;
+	}
+
+	/* Reports on demand come out at the next safepoint */
+	if (memStats.enabled)
+		signal(SIGUSR2, memStatsSignal);
+
+	/* A compiled program gets all of its functions up front */
+	if (emitPath)
+		lazyFunctions = false;
+
 	/* Open program file */
-	yyin = fopen(argv[1], "r");
+	yyin = fopen(argv[arg], "r");
 	if (!yyin)
 	{
 		fprintf(stderr, "couldn't open file for reading\n");
@@ -34,14 +218,96 @@ int main(int argc, char *argv[])
 	std::list<Statement*>* program = NULL;
 
 	/* Parse program */
+	tracer.begin("parse");
 	yyparse(program);
+	tracer.end("parse");
+
+	/* Pick up where a snapshot of this script left off */
+	if ((snapshot.savePath || restorePath) && !snapshot.hashSource(argv[arg]))
+	{
+		fprintf(stderr, "couldn't open file for reading\n");
+		return 1;
+	}
+	if (restorePath && !snapshot.load(restorePath))
+		return 1;
+
+	/* Start from what the last run of this script learned */
+	if (profilePath)
+	{
+		if (!typeProfile.load(profilePath, argv[arg]))
+			return 1;
+		typeProfile.parseCalled();
+	}
+
+	/* Prove what types we can before we start */
+	tracer.begin("infer types");
+	inferTypes(program, checkTypes);
+	tracer.end("infer types");
+
+	/* Write it out to be compiled, rather than running it */
+	if (emitPath)
+	{
+		if (!strcmp(emitPath, "-"))
+			emitCpp(program, argv[arg], std::cout);
+		else
+		{
+			std::ofstream out(emitPath);
+			if (out)
+				emitCpp(program, argv[arg], out);
+			if (!out)
+			{
+				fprintf(stderr, "couldn't open %s for writing\n", emitPath);
+				return 1;
+			}
+		}
+		return 0;
+	}
 
 	/* Run program */
-	runProgram(program);
+	if (sampleRate && !profiler.start(sampleRate))
+	{
+		fprintf(stderr, "couldn't start the sampling timer\n");
+		sampleRate = 0;
+	}
+	if (countPerf && !perfCounters.start())
+	{
+		fprintf(stderr, "perf: no counters available: %s\n", perfCounters.missing.c_str());
+		countPerf = false;
+	}
+	bool aborted = runProgram(program);
+	if (profilePath)
+		typeProfile.save();
+	if (countPerf)
+	{
+		perfCounters.stop();
+		perfCounters.print(stderr);
+	}
+	if (sampleRate)
+	{
+		profiler.stop();
+		FILE* out = fopen(sampleOut, "w");
+		if (out)
+		{
+			profiler.print(out);
+			fclose(out);
+			fprintf(stderr, "sample: %lu samples (%lu dropped) written to %s\n",
+				profiler.samples, profiler.dropped, sampleOut);
+		}
+		else
+			fprintf(stderr, "couldn't open %s for writing\n", sampleOut);
+	}
+
+	stopTrace(tracePath);
+
+	if (gcStats)
+		heap.printStats(stderr);
+	if (memStats.enabled)
+		memStats.print(stderr);
 
 	/* delete the AST */
 	for (auto &it : *program) delete it;
 	delete program;
 
-	return 0;
+	/* A script stopped by one of its limits didn't finish */
+	return aborted ? 1 : 0;
 }
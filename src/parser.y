@@ -15,22 +15,25 @@ int yylex();
 %parse-param { std::list<Statement*>* &program }
 
 %union {
-	char* string_val;
+	const Atom* atom;
 	int int_val;
 	Expression* expression;
 	Statement* statement;
 	std::list<Expression*>* expression_list;
 	std::list<Statement*>* statement_list;
-	std::list<std::string>* identifier_list;
+	std::list<const Atom*>* identifier_list;
+	FunctionSource* source;
 }
 
 %locations
 
-%token <string_val> STRING ID
+%token <atom> STRING ID
 %token <int_val> INTEGER
 %token START_TAG STOP_TAG DOC_WRITE VAR NEWLINE COLON SEMICOLON BRTAG
 %token IF ELSE WHILE DO BREAK CONTINUE TRUE FALSE GT LT GE LE NE EQ OR AND NOT
 %token FUNCTION RETURN ASSERT
+%token <source> LAZY_BODY
+%token BODY_START
 
 %type <expression> expression or_expression and_expression 
 %type <expression> equality_expression comparison_expression addsub_expression
@@ -46,6 +49,7 @@ int yylex();
 
 file:
 		optnewlines START_TAG program STOP_TAG optnewlines
+		| BODY_START NEWLINE statements '}'              { program = $3; }
 		;
 
 program:
@@ -126,7 +130,8 @@ do_while_statement:
 
 function_statement:
 		FUNCTION ID '(' func_params ')' '{' NEWLINE statements '}'
-		                                                 { $$ = new Function(std::string($2), $4, $8, @1.first_line); free($2); }
+		                                                 { $$ = new Function($2, $4, $8, @1.first_line); }
+		| FUNCTION ID '(' func_params ')' LAZY_BODY      { $$ = new Function($2, $4, $6, @1.first_line); }
 		;
 
 parameters:
@@ -136,18 +141,18 @@ parameters:
 		;
 
 func_params:
-		ID                                               { $$ = new std::list<std::string>(1, std::string($1)); free($1); }
-		| func_params ',' ID                             { $1->push_back(std::string($3)); $$ = $1; free($3); }
-		| /* Empty func_param */                         { $$ = new std::list<std::string>(); }
+		ID                                               { $$ = new std::list<const Atom*>(1, $1); }
+		| func_params ',' ID                             { $1->push_back($3); $$ = $1; }
+		| /* Empty func_param */                         { $$ = new std::list<const Atom*>(); }
 
 identifier:
-		ID                                               { $$ = new Variable(std::string($1), @1.first_line); free($1); }
-		| ID '.' ID                                      { $$ = new Variable(std::string($1), std::string($3), @1.first_line); free($1); }
-		| ID '[' expression ']'                          { $$ = new Variable(std::string($1), $3, @1.first_line); free($1); }
+		ID                                               { $$ = new Variable($1, @1.first_line); }
+		| ID '.' ID                                      { $$ = new Variable($1, $3, @1.first_line); }
+		| ID '[' expression ']'                          { $$ = new Variable($1, $3, @1.first_line); }
 		;
 
 singleid:
-		ID                                               { $$ = new Variable(std::string($1), @1.first_line); free($1); }
+		ID                                               { $$ = new Variable($1, @1.first_line); }
 		;
 
 expression:
@@ -156,38 +161,38 @@ expression:
 
 or_expression:
 		and_expression                                   { $$ = $1; }
-		| or_expression OR and_expression                { $$ = new Operation(Operation::OR, $1, $3, @2.first_line); }
+		| or_expression OR and_expression                { $$ = new Operation(Operation::OR, $1, $3, @2.first_line, @2.first_column); }
 		;
 
 and_expression:
 		equality_expression                              { $$ = $1; }
-		| and_expression AND equality_expression         { $$ = new Operation(Operation::AND, $1, $3, @2.first_line); }
+		| and_expression AND equality_expression         { $$ = new Operation(Operation::AND, $1, $3, @2.first_line, @2.first_column); }
 		;
 
 equality_expression:
 		comparison_expression                            { $$ = $1; }
-		| equality_expression NE comparison_expression   { $$ = new Operation(Operation::NE, $1, $3, @2.first_line); }
-		| equality_expression EQ comparison_expression   { $$ = new Operation(Operation::EQ, $1, $3, @2.first_line); }
+		| equality_expression NE comparison_expression   { $$ = new Operation(Operation::NE, $1, $3, @2.first_line, @2.first_column); }
+		| equality_expression EQ comparison_expression   { $$ = new Operation(Operation::EQ, $1, $3, @2.first_line, @2.first_column); }
 		;
 
 comparison_expression:
 		addsub_expression                                { $$ = $1; }
-		| comparison_expression GT addsub_expression     { $$ = new Operation(Operation::GT, $1, $3, @2.first_line); }
-		| comparison_expression LT addsub_expression     { $$ = new Operation(Operation::LT, $1, $3, @2.first_line); }
-		| comparison_expression GE addsub_expression     { $$ = new Operation(Operation::GE, $1, $3, @2.first_line); }
-		| comparison_expression LE addsub_expression     { $$ = new Operation(Operation::LE, $1, $3, @2.first_line); }
+		| comparison_expression GT addsub_expression     { $$ = new Operation(Operation::GT, $1, $3, @2.first_line, @2.first_column); }
+		| comparison_expression LT addsub_expression     { $$ = new Operation(Operation::LT, $1, $3, @2.first_line, @2.first_column); }
+		| comparison_expression GE addsub_expression     { $$ = new Operation(Operation::GE, $1, $3, @2.first_line, @2.first_column); }
+		| comparison_expression LE addsub_expression     { $$ = new Operation(Operation::LE, $1, $3, @2.first_line, @2.first_column); }
 		;
 
 addsub_expression:
 		multidiv_expression                              { $$ = $1; }
-		| addsub_expression '+' multidiv_expression      { $$ = new Operation(Operation::ADDITION, $1, $3, @2.first_line); }
-		| addsub_expression '-' multidiv_expression      { $$ = new Operation(Operation::SUBTRACTION, $1, $3, @2.first_line); }
+		| addsub_expression '+' multidiv_expression      { $$ = new Operation(Operation::ADDITION, $1, $3, @2.first_line, @2.first_column); }
+		| addsub_expression '-' multidiv_expression      { $$ = new Operation(Operation::SUBTRACTION, $1, $3, @2.first_line, @2.first_column); }
 		;
 
 multidiv_expression:
 		negation_expression                              { $$ = $1; }
-		| multidiv_expression '*' negation_expression    { $$ = new Operation(Operation::MULTIPLICATION, $1, $3, @2.first_line); }
-		| multidiv_expression '/' negation_expression    { $$ = new Operation(Operation::DIVISION, $1, $3, @2.first_line); }
+		| multidiv_expression '*' negation_expression    { $$ = new Operation(Operation::MULTIPLICATION, $1, $3, @2.first_line, @2.first_column); }
+		| multidiv_expression '/' negation_expression    { $$ = new Operation(Operation::DIVISION, $1, $3, @2.first_line, @2.first_column); }
 		;
 
 negation_expression:
@@ -197,7 +202,7 @@ negation_expression:
 
 single_expression:
 		INTEGER                                          { $$ = new IntConst($1, @1.first_line); }
-		| STRING                                         { $$ = new StringConst(std::string($1), @1.first_line); free($1); }
+		| STRING                                         { $$ = new StringConst($1, @1.first_line); }
 		| BRTAG                                          { $$ = new BRConst(@1.first_line); }
 		| TRUE                                           { $$ = new BoolConst(true, @1.first_line); }
 		| FALSE                                          { $$ = new BoolConst(false, @1.first_line); }
@@ -207,7 +212,7 @@ single_expression:
 		;
 
 function_call:
-		ID '(' parameters ')'                            { $$ = new Callable(std::string($1), $3, @1.first_line); free($1); }
+		ID '(' parameters ')'                            { $$ = new Callable($1, $3, @1.first_line); }
 		;
 
 object_init:
@@ -0,0 +1,177 @@
+/*
+ * CS352 Spring 2015
+ * Hardware performance counters for miniscript
+ * Andrew F. Davis
+ */
+
+#include "perfcounters.hh"
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using namespace std;
+
+PerfCounters perfCounters;
+
+static const struct {
+	const char* name;
+	uint32_t type;
+	uint64_t config;
+} counterEvents[PerfCounters::COUNTERS] = {
+	{ "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int openEvent(uint32_t type, uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	// the group starts together once it is all there
+	attr.disabled = group < 0;
+	// what the interpreter does, not the kernel on its behalf
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+bool PerfCounters::start()
+{
+	// members of a group read back in the order they were added
+	for (int i = 0; i < COUNTERS; i++)
+	{
+		slot[i] = -1;
+		int fd = openEvent(counterEvents[i].type, counterEvents[i].config, leader);
+		if (fd < 0)
+		{
+			missing += missing.empty() ? "" : ", ";
+			missing += string(counterEvents[i].name) + " (" + strerror(errno) + ")";
+			continue;
+		}
+		if (leader < 0)
+			leader = fd;
+		slot[i] = fds.size();
+		fds.push_back(fd);
+	}
+	if (leader < 0)
+		return false;
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	enabled = true;
+	charge();
+	return true;
+}
+
+void PerfCounters::stop()
+{
+	if (!enabled)
+		return;
+	charge();
+	enabled = false;
+	ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	for (auto &it : fds)
+		close(it);
+	fds.clear();
+	leader = -1;
+}
+
+void PerfCounters::charge()
+{
+	uint64_t values[1 + COUNTERS];
+	if (read(leader, values, sizeof(values)) < (ssize_t)sizeof(uint64_t))
+		return;
+
+	Site* site = stack.empty() ? &outside : stack.back();
+	for (int i = 0; i < COUNTERS; i++)
+	{
+		if (slot[i] < 0 || (uint64_t)slot[i] >= values[0])
+			continue;
+		uint64_t now = values[1 + slot[i]];
+		site->counts[i] += now - last[i];
+		last[i] = now;
+	}
+}
+
+void PerfCounters::push(Site* site)
+{
+	charge();
+	site->calls++;
+	stack.push_back(site);
+}
+
+void PerfCounters::leave()
+{
+	charge();
+	stack.pop_back();
+}
+
+static void printCount(FILE* out, bool counted, double value, const char* format)
+{
+	if (counted)
+		fprintf(out, format, value);
+	else
+		fprintf(out, "%12s", "-");
+}
+
+void PerfCounters::print(FILE* out)
+{
+	vector<pair<string, const Site*>> rows;
+	rows.push_back(make_pair("(outside)", &outside));
+	for (auto &it : functions)
+		rows.push_back(make_pair(string("function ") + it.first, &it.second));
+	for (auto &it : statements)
+		rows.push_back(make_pair("line " + to_string(it.first), &it.second));
+
+	// sort on cycles if we have them, time if not
+	int key = slot[CYCLES] >= 0 ? CYCLES : TASK_CLOCK;
+	stable_sort(rows.begin(), rows.end(), [key](const pair<string, const Site*> &a, const pair<string, const Site*> &b) {
+		return a.second->counts[key] > b.second->counts[key];
+	});
+
+	Site total;
+	for (auto &it : rows)
+		for (int i = 0; i < COUNTERS; i++)
+			total.counts[i] += it.second->counts[i];
+	rows.push_back(make_pair("(total)", &total));
+
+	fprintf(out, "perf: %-24s %10s %12s %12s %12s %12s %12s %12s\n", "site", "calls", "cpu ms",
+		"cycles", "instructions", "IPC", "cache MPKI", "branch MPKI");
+	for (auto &it : rows)
+	{
+		const uint64_t* counts = it.second->counts;
+		double instructions = counts[INSTRUCTIONS];
+		bool perInstruction = slot[INSTRUCTIONS] >= 0 && instructions > 0;
+
+		fprintf(out, "perf: %-24s %10lu ", it.first.c_str(), it.second->calls);
+		printCount(out, slot[TASK_CLOCK] >= 0, counts[TASK_CLOCK] / 1e6, "%12.3f");
+		fputc(' ', out);
+		printCount(out, slot[CYCLES] >= 0, counts[CYCLES], "%12.0f");
+		fputc(' ', out);
+		printCount(out, slot[INSTRUCTIONS] >= 0, instructions, "%12.0f");
+		fputc(' ', out);
+		printCount(out, perInstruction && slot[CYCLES] >= 0 && counts[CYCLES] > 0,
+			instructions / counts[CYCLES], "%12.2f");
+		fputc(' ', out);
+		// misses per thousand instructions
+		printCount(out, perInstruction && slot[CACHE_MISSES] >= 0,
+			counts[CACHE_MISSES] * 1000 / instructions, "%12.2f");
+		fputc(' ', out);
+		printCount(out, perInstruction && slot[BRANCH_MISSES] >= 0,
+			counts[BRANCH_MISSES] * 1000 / instructions, "%12.2f");
+		fputc('\n', out);
+	}
+	if (!missing.empty())
+		fprintf(out, "perf: not counted: %s\n", missing.c_str());
+}
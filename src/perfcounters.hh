@@ -0,0 +1,95 @@
+/*
+ * CS352 Spring 2015
+ * Hardware performance counters for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _PERFCOUNTERS_H
+#define _PERFCOUNTERS_H
+
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+ * Counts cycles, instructions, cache misses and branch misses with
+ * perf_event_open and charges them to whichever script function or
+ * top-level statement is running, each getting only its own share
+ * and not that of the functions it calls. The counters are one group
+ * read in a single system call at every call, return and statement.
+ * Any the kernel or the machine can't give us read as missing, and
+ * without any at all we run uncounted.
+ */
+class PerfCounters
+{
+public:
+	enum Counter {
+		TASK_CLOCK,        // nanoseconds on the CPU, always there
+		CYCLES,
+		INSTRUCTIONS,
+		CACHE_MISSES,
+		BRANCH_MISSES,
+		COUNTERS
+	};
+
+	/* checked before counting anything, off unless started */
+	bool enabled = false;
+
+	/* open the counters on this thread, false if none would open */
+	bool start();
+	void stop();
+
+	void enter(const char* function)
+	{
+		push(&functions[function]);
+	}
+	void enter(int lineNumber)
+	{
+		push(&statements[lineNumber]);
+	}
+	void leave();
+
+	/* a row per function and statement, most cycles (or time) first */
+	void print(FILE* out);
+
+	/* why counters are missing, empty if none are */
+	std::string missing;
+
+private:
+	struct Site {
+		unsigned long calls = 0;
+		uint64_t counts[COUNTERS] = {};
+	};
+
+	int leader = -1;
+	std::vector<int> fds;
+	/* where each counter comes in a group read, -1 if not counted */
+	int slot[COUNTERS];
+
+	uint64_t last[COUNTERS] = {};
+	Site outside;
+	std::vector<Site*> stack;
+
+	std::unordered_map<const char*, Site> functions;
+	std::map<int, Site> statements;
+
+	void push(Site* site);
+	/* everything since the last read goes to the innermost site */
+	void charge();
+};
+
+extern PerfCounters perfCounters;
+
+/* counts a function or top-level statement while it is running */
+class PerfFrame
+{
+public:
+	template <class Key>
+	PerfFrame(Key key) { if (perfCounters.enabled) perfCounters.enter(key); }
+	~PerfFrame() { if (perfCounters.enabled) perfCounters.leave(); }
+};
+
+#endif // _PERFCOUNTERS_H
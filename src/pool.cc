@@ -0,0 +1,74 @@
+/*
+ * CS352 Spring 2015
+ * Slab allocator for miniscript
+ * Andrew F. Davis
+ */
+
+#include "pool.hh"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+SlabPool::SlabPool()
+{
+	for (size_t i = 0; i < CLASSES; i++)
+	{
+		freeLists[i] = NULL;
+		bump[i] = NULL;
+		bumpEnd[i] = NULL;
+	}
+}
+
+SlabPool::~SlabPool()
+{
+	for (auto &it : slabs)
+		::free(it);
+}
+
+void* SlabPool::carve(unsigned char sizeClass, size_t size)
+{
+	if (!sizeClass)
+	{
+		void* pointer = ::operator new(size);
+		stats[0].inUse++;
+		stats[0].carved++;
+		return pointer;
+	}
+
+	size_t cellSize = sizeClass * GRANULE;
+	if (!bump[sizeClass] || (size_t)(bumpEnd[sizeClass] - bump[sizeClass]) < cellSize)
+	{
+		// malloc gives us at least GRANULE alignment
+		char* slab = (char*)malloc(SLAB_SIZE);
+		if (!slab)
+			throw bad_alloc();
+		slabs.push_back(slab);
+		stats[sizeClass].slabs++;
+		bump[sizeClass] = slab;
+		bumpEnd[sizeClass] = slab + SLAB_SIZE;
+	}
+
+	void* pointer = bump[sizeClass];
+	bump[sizeClass] += cellSize;
+	stats[sizeClass].inUse++;
+	stats[sizeClass].carved++;
+	return pointer;
+}
+
+void SlabPool::printStats(FILE* out)
+{
+	fprintf(out, "pool: %-6s %8s %10s %10s %10s %10s\n", "size", "slabs", "in use", "free", "carved", "occupancy");
+	for (size_t i = 1; i < CLASSES; i++)
+	{
+		if (!stats[i].slabs)
+			continue;
+		size_t capacity = stats[i].slabs * (SLAB_SIZE / (i * GRANULE));
+		fprintf(out, "pool: %-6zu %8zu %10lu %10lu %10lu %9.1f%%\n", i * GRANULE, stats[i].slabs,
+			stats[i].inUse, stats[i].carved - stats[i].inUse, stats[i].carved,
+			100.0 * stats[i].inUse / capacity);
+	}
+	if (stats[0].carved)
+		fprintf(out, "pool: %-6s %8s %10lu %10s %10lu\n", "large", "-", stats[0].inUse, "-", stats[0].carved);
+}
@@ -0,0 +1,91 @@
+/*
+ * CS352 Spring 2015
+ * Slab allocator for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+/*
+ * Size-class pools for the collected heap. Objects are rounded up to
+ * a multiple of GRANULE and carved out of slabs of their own class,
+ * freed ones go on a free list for their class and are handed out
+ * again before anything new is carved. Every heap has its own pool,
+ * so nothing here is shared between threads, and a slab is never
+ * given back until its heap goes. Anything bigger than MAX_SIZE goes
+ * to the general purpose allocator.
+ */
+class SlabPool
+{
+public:
+	static const size_t GRANULE = 16;
+	static const size_t MAX_SIZE = 256;
+	static const size_t CLASSES = MAX_SIZE / GRANULE + 1;  // class 0 is for the big ones
+	static const size_t SLAB_SIZE = 64 * 1024;
+
+	static unsigned char sizeClass(size_t size)
+	{
+		return size > MAX_SIZE ? 0 : (size + GRANULE - 1) / GRANULE;
+	}
+
+	SlabPool();
+	~SlabPool();
+	SlabPool(const SlabPool&) = delete;
+	SlabPool& operator=(const SlabPool&) = delete;
+
+	void* allocate(unsigned char sizeClass, size_t size)
+	{
+		FreeCell* cell = freeLists[sizeClass];
+		if (cell)
+		{
+			freeLists[sizeClass] = cell->next;
+			stats[sizeClass].inUse++;
+			return cell;
+		}
+		return carve(sizeClass, size);
+	}
+
+	void free(void* pointer, unsigned char sizeClass)
+	{
+		if (!sizeClass)
+		{
+			stats[0].inUse--;
+			::operator delete(pointer);
+			return;
+		}
+		FreeCell* cell = (FreeCell*)pointer;
+		cell->next = freeLists[sizeClass];
+		freeLists[sizeClass] = cell;
+		stats[sizeClass].inUse--;
+	}
+
+	/* slabs and cells in use for each class */
+	void printStats(FILE* out);
+
+private:
+	struct FreeCell {
+		FreeCell* next;
+	};
+
+	struct ClassStats {
+		size_t slabs = 0;
+		unsigned long inUse = 0;
+		unsigned long carved = 0;
+	};
+
+	FreeCell* freeLists[CLASSES];
+	/* what is left of the slab being carved up for each class */
+	char* bump[CLASSES];
+	char* bumpEnd[CLASSES];
+	ClassStats stats[CLASSES];
+	std::vector<void*> slabs;
+
+	void* carve(unsigned char sizeClass, size_t size);
+};
+
+#endif // _POOL_H
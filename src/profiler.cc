@@ -0,0 +1,119 @@
+/*
+ * CS352 Spring 2015
+ * Sampling profiler for miniscript
+ * Andrew F. Davis
+ */
+
+#include "profiler.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/time.h>
+
+#include "ast.hh"
+
+using namespace std;
+
+Profiler profiler;
+
+thread_local const char* volatile Profiler::frames[Profiler::MAX_DEPTH];
+thread_local volatile sig_atomic_t Profiler::depth = 0;
+
+void Profiler::signalHandler(int)
+{
+	profiler.sample();
+}
+
+void Profiler::sample()
+{
+	int next = (head + 1) % RING_SIZE;
+	if (next == tail)
+	{
+		// we have not been drained in a while
+		overflow = overflow + 1;
+		return;
+	}
+
+	Sample &s = ring[head];
+	s.depth = depth;
+	s.lineNumber = currentLine;
+	for (int i = 0; i < s.depth && i < MAX_DEPTH; i++)
+		s.frames[i] = frames[i];
+	head = next;
+}
+
+void Profiler::swapStack(Stack &other)
+{
+	// a sample landing in the middle sees an empty stack
+	int running = depth;
+	depth = 0;
+	for (int i = 0; i < MAX_DEPTH && (i < running || i < other.depth); i++)
+	{
+		const char* frame = frames[i];
+		frames[i] = other.frames[i];
+		other.frames[i] = frame;
+	}
+	depth = other.depth;
+	other.depth = running;
+}
+
+bool Profiler::start(unsigned int hz)
+{
+	if (hz == 0)
+		return false;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = signalHandler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, NULL))
+		return false;
+
+	// ITIMER_PROF counts our CPU time, not time spent blocked
+	long period = (hz >= 1000000) ? 1 : 1000000 / hz;
+	struct itimerval timer;
+	timer.it_interval.tv_sec = period / 1000000;
+	timer.it_interval.tv_usec = period % 1000000;
+	timer.it_value = timer.it_interval;
+	return !setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void Profiler::stop()
+{
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	signal(SIGPROF, SIG_IGN);
+	drain();
+}
+
+void Profiler::drain()
+{
+	while (tail != head)
+	{
+		const Sample &s = ring[tail];
+
+		string stack = "(program)";
+		for (int i = 0; i < s.depth && i < MAX_DEPTH; i++)
+		{
+			stack += ';';
+			stack += s.frames[i];
+		}
+		if (s.depth > MAX_DEPTH)
+			stack += ";[truncated]";
+		stack += ";line ";
+		stack += to_string(s.lineNumber);
+
+		folded[stack]++;
+		samples++;
+		tail = (tail + 1) % RING_SIZE;
+	}
+	dropped = overflow;
+}
+
+void Profiler::print(FILE* out)
+{
+	for (auto &it : folded)
+		fprintf(out, "%s %lu\n", it.first.c_str(), it.second);
+}
@@ -0,0 +1,94 @@
+/*
+ * CS352 Spring 2015
+ * Sampling profiler for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <cstdio>
+#include <csignal>
+#include <map>
+#include <string>
+
+/*
+ * Samples the script call stack from a SIGPROF timer. The interpreter
+ * keeps a shadow stack of active function names; the signal handler
+ * only copies it, along with the current line, into a ring buffer that
+ * is drained into folded stacks at safepoints.
+ */
+class Profiler
+{
+public:
+	static const int MAX_DEPTH = 64;
+	static const int RING_SIZE = 1024;
+
+	/* the active functions, outermost first */
+	void enter(const char* name)
+	{
+		if (depth < MAX_DEPTH)
+			frames[depth] = name;
+		depth = depth + 1;
+	}
+	void leave() { depth = depth - 1; }
+
+	/* a shadow stack kept aside, for a scheduler task switched out */
+	struct Stack {
+		const char* frames[MAX_DEPTH];
+		int depth = 0;
+	};
+	/* trade this thread's shadow stack for another */
+	void swapStack(Stack &other);
+
+	/* start and stop the sampling timer */
+	bool start(unsigned int hz);
+	void stop();
+
+	/* fold whatever samples are waiting, cheap when there are none */
+	void poll()
+	{
+		if (head != tail)
+			drain();
+	}
+
+	/* write "frame;frame;frame count" lines for flamegraph tools */
+	void print(FILE* out);
+
+	unsigned long samples = 0;
+	unsigned long dropped = 0;
+
+private:
+	/* each thread keeps its own, the signal samples whichever it lands on */
+	static thread_local const char* volatile frames[MAX_DEPTH];
+	static thread_local volatile sig_atomic_t depth;
+
+	/* written by the signal handler at head, read by us at tail */
+	struct Sample {
+		int depth;
+		int lineNumber;
+		const char* frames[MAX_DEPTH];
+	};
+	Sample ring[RING_SIZE];
+	volatile sig_atomic_t head = 0;
+	volatile sig_atomic_t tail = 0;
+	volatile sig_atomic_t overflow = 0;
+
+	std::map<std::string, unsigned long> folded;
+
+	void drain();
+	void sample();
+	static void signalHandler(int);
+};
+
+extern Profiler profiler;
+
+/* keeps a function on the shadow stack while it is executing */
+class ProfileFrame
+{
+public:
+	ProfileFrame(const char* name) { profiler.enter(name); }
+	~ProfileFrame() { profiler.leave(); }
+};
+
+#endif // _PROFILER_H
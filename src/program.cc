@@ -0,0 +1,136 @@
+/*
+ * CS352 Spring 2015
+ * Parsed program cache for miniscript
+ * Andrew F. Davis
+ */
+
+#include "program.hh"
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+
+#include "miniscript.hh"
+
+using namespace std;
+
+extern FILE *yyin;
+extern int yylineno;
+int yyparse(std::list<Statement*>* &program);
+void restartLexer(FILE* file);
+
+/* spare parsed copies of a script we hold on to */
+static const size_t MAX_IDLE_COPIES = 8;
+
+static thread_local map<string, vector<CachedProgram*>> programCache;
+
+/* take a parsed copy of a script, parsing it if we have none spare */
+CachedProgram* checkoutProgram(const string &path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st))
+	{
+		fprintf(scriptErr, "couldn't open file for reading\n");
+		return NULL;
+	}
+
+	vector<CachedProgram*> &copies = programCache[path];
+	while (!copies.empty())
+	{
+		CachedProgram* cached = copies.back();
+		copies.pop_back();
+		if (cached->mtime.tv_sec == st.st_mtim.tv_sec &&
+			cached->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+			cached->size == st.st_size)
+			return cached;
+		// the script changed under us
+		delete cached;
+	}
+
+	FILE* file = fopen(path.c_str(), "r");
+	if (!file)
+	{
+		fprintf(scriptErr, "couldn't open file for reading\n");
+		return NULL;
+	}
+
+	CachedProgram* cached = new CachedProgram;
+	cached->mtime = st.st_mtim;
+	cached->size = st.st_size;
+	{
+		lock_guard<mutex> lock(parseLock);
+
+		// functions register themselves in the global context as
+		// they are parsed, start a fresh one to collect them in
+		globalContext = newGlobalContext();
+		parsedStatements = &cached->statements;
+		parsedExpressions = &cached->expressions;
+		AtomScope* outerAtoms = atomScope;
+		atomScope = &cached->atoms;
+		yyin = file;
+		restartLexer(file);
+		yylineno = 1;
+		tracer.begin("parse");
+		int failed = yyparse(cached->program);
+		tracer.end("parse");
+		parsedStatements = NULL;
+		atomScope = outerAtoms;
+		fclose(file);
+		if (failed || cached->program == NULL)
+		{
+			// what we parsed so far is lost with the parser's stack
+			cached->program = NULL;
+			parsedExpressions = NULL;
+			delete cached;
+			return NULL;
+		}
+
+		TraceScope traceScope("infer types");
+		inferTypes(cached->program, false);
+		parsedExpressions = NULL;
+	}
+	for (auto &it : *globalContext)
+		if (it.symbol->type == Symbol::FUNCTION)
+			cached->functions.push_back(make_pair(it.name, it.symbol->function));
+
+	return cached;
+}
+
+/* hand a copy back once its run is over */
+void checkinProgram(const string &path, CachedProgram* cached)
+{
+	vector<CachedProgram*> &copies = programCache[path];
+	if (copies.size() < MAX_IDLE_COPIES)
+		copies.push_back(cached);
+	else
+		delete cached;
+}
+
+void startProgram(CachedProgram* cached, const Limits &limits)
+{
+	for (auto &it : cached->statements)
+		it->errorReported = false;
+	// nothing the last run left in the AST is seen by this one,
+	// constants are all that start out with a value
+	for (auto &it : cached->expressions)
+		if (!dynamic_cast<Constant*>(it))
+			it->symbol = Symbol();
+	globalContext = newGlobalContext();
+	// names the run comes up with (lazy bodies, records) go with the program
+	atomScope = &cached->atoms;
+	for (auto &it : cached->functions)
+	{
+		Symbol* function = heap.allocate<Symbol>();
+		function->type = Symbol::FUNCTION;
+		function->declared = true;
+		function->assigned = true;
+		function->function = it.second;
+		globalContext->insert(it.first, function);
+	}
+	while (!callStack.empty())
+		callStack.pop();
+	::limits = limits;
+	statementCount = 0;
+	currentLine = 0;
+}
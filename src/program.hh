@@ -0,0 +1,60 @@
+/*
+ * CS352 Spring 2015
+ * Parsed program cache for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _PROGRAM_H
+#define _PROGRAM_H
+
+#include <ctime>
+#include <list>
+#include <string>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
+
+#include "ast.hh"
+#include "runtime.hh"
+
+/*
+ * A parsed script. Running a program writes into its AST (each
+ * expression holds its value, operations quicken) and the AST's
+ * values are rooted in the heap of the thread that parsed it, so
+ * each run takes a copy of its own out of its thread's cache,
+ * parsing another when all the copies are busy.
+ */
+struct CachedProgram
+{
+	struct timespec mtime;
+	off_t size;
+	std::list<Statement*>* program = NULL;
+	/* every statement, their error flags are reset between runs */
+	std::vector<Statement*> statements;
+	/* every expression, their values are reset between runs */
+	std::vector<Expression*> expressions;
+	/* functions registered while parsing, each run gets these globals */
+	std::vector<std::pair<const Atom*, Function*>> functions;
+	/* the atoms all of that uses, let go of with the rest */
+	AtomScope atoms;
+
+	~CachedProgram()
+	{
+		if (program)
+		{
+			for (auto &it : *program) delete it;
+			delete program;
+		}
+		for (auto &it : functions) delete it.second;
+	}
+};
+
+/* take a parsed copy of a script, parsing it if we have none spare */
+CachedProgram* checkoutProgram(const std::string &path);
+/* hand a copy back once its run is over */
+void checkinProgram(const std::string &path, CachedProgram* cached);
+
+/* set up this thread to run a copy as if it had just been parsed */
+void startProgram(CachedProgram* cached, const Limits &limits);
+
+#endif // _PROGRAM_H
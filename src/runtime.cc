@@ -7,18 +7,59 @@
 #include "runtime.hh"
 
 #include <cstdio>
+#include <ctime>
 #include <map>
 
 #include "miniscript.hh"
 #include "ast.hh"
+#include "snapshot.hh"
+#include "scheduler.hh"
+#include "builtins.hh"
 
 using namespace std;
 
+/*
+ * Everything a running script touches is per thread, so a server
+ * can run a script on each of its workers at once.
+ */
+
+/* the collected heap, must come up before anything is allocated on it */
+thread_local Heap heap;
+
 /* generate a new global execution context/symbol table */
-ContextPtr globalContext = make_shared<map<string, shared_ptr<Symbol>>>();
+thread_local ContextPtr globalContext = newGlobalContext();
 
 /* Used for passing arguments to functions */
-stack<Expression*> callStack;
+thread_local stack<Expression*> callStack;
+
+thread_local FILE* scriptOut = stdout;
+thread_local FILE* scriptErr = stderr;
+
+thread_local int currentLine = 0;
+thread_local unsigned long statementCount = 0;
+thread_local std::vector<Statement*>* parsedStatements = NULL;
+thread_local std::vector<Expression*>* parsedExpressions = NULL;
+
+thread_local Limits limits;
+
+std::mutex parseLock;
+
+/* how many safepoints go by between looking at the clock */
+static const unsigned long CLOCK_POLLS = 256;
+
+/* arrays this long or more go sparse if most of them would be gaps */
+static const size_t SPARSE_MIN_LENGTH = 64;
+/* sparse once there would be this many indexes for every cell */
+static const size_t SPARSE_GAP_RATIO = 8;
+/* and dense again once at least one in this many are filled in */
+static const size_t DENSE_FILL_RATIO = 2;
+
+static long milliseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 void MS_ERROR::report(bool &errorReported, ERROR_TYPE type, int lineNumber, std::string varName)
 {
@@ -27,54 +68,340 @@ void MS_ERROR::report(bool &errorReported, ERROR_TYPE type, int lineNumber, std:
 		switch (type)
 		{
 			case MS_ERROR::TYPE:
-				fprintf(stderr, "Line %d, type violation\n", lineNumber);
+				fprintf(scriptErr, "Line %d, type violation\n", lineNumber);
 				break;
 			case MS_ERROR::VALUE:
-				fprintf(stderr, "Line %d, %s has no value\n", lineNumber, varName.c_str());
+				fprintf(scriptErr, "Line %d, %s has no value\n", lineNumber, varName.c_str());
 				break;
 			case MS_ERROR::PARAMETER:
-				fprintf(stderr, "Line %d, unknown parameter type\n", lineNumber);
+				fprintf(scriptErr, "Line %d, unknown parameter type\n", lineNumber);
 				break;
 			case MS_ERROR::CONDITION:
-				fprintf(stderr, "Line %d, condition unknown\n", lineNumber);
+				fprintf(scriptErr, "Line %d, condition unknown\n", lineNumber);
 				break;
 			case MS_ERROR::UNDECLARED:
-				fprintf(stderr, "Line %d, %s undeclared\n", lineNumber, varName.c_str());
+				fprintf(scriptErr, "Line %d, %s undeclared\n", lineNumber, varName.c_str());
+				break;
+			case MS_ERROR::FUEL:
+				fprintf(scriptErr, "Line %d, statement limit exceeded\n", lineNumber);
+				break;
+			case MS_ERROR::TIMEOUT:
+				fprintf(scriptErr, "Line %d, time limit exceeded\n", lineNumber);
+				break;
+			case MS_ERROR::MEMORY:
+				fprintf(scriptErr, "Line %d, memory limit exceeded\n", lineNumber);
 				break;
 			default:
-				fprintf(stderr, "\"Unknown error\" error :p\n");
+				fprintf(scriptErr, "\"Unknown error\" error :p\n");
 				break;
 		}
 	// we have now
 	errorReported = true;
 }
 
-shared_ptr<Symbol> getTableSymbol(ContextPtr context, string name)
+ContextPtr newGlobalContext()
+{
+	// every thread that runs scripts starts here
+	metrics.attach();
+	ContextPtr context = heap.allocate<Context>();
+	installNatives(context);
+	return context;
+}
+
+Symbol* getTableSymbol(ContextPtr context, const Atom* name)
 {
 	// check for the variable in the symbol table
-	if (!context->count(name))
+	metrics.add(Metrics::LOOKUPS);
+	Symbol* symbol = context->find(name);
+	if (!symbol)
 	{
+		metrics.add(Metrics::LOOKUP_MISSES);
 		// if not we create it but leave it undeclared
-		(*context)[name] = make_shared<Symbol>();
+		symbol = heap.allocate<Symbol>();
+		context->insert(name, symbol);
 	}
 	// return the pointer to the symbol
-	return (*context)[name];
+	return symbol;
+}
+
+void Context::insert(const Atom* name, Symbol* symbol)
+{
+	// keep at least a quarter of the slots free
+	if ((count + 1) * 4 > capacity * 3)
+		grow();
+
+	uint32_t i = name->hash & (capacity - 1);
+	for (; entries[i].symbol; i = (i + 1) & (capacity - 1))
+		if (entries[i].name == name)
+		{
+			entries[i].symbol = symbol;
+			return;
+		}
+	entries[i].name = name;
+	entries[i].symbol = symbol;
+	count++;
+}
+
+void Context::grow()
+{
+	Entry* old = entries;
+	uint32_t oldCapacity = capacity;
+
+	capacity *= 2;
+	entries = new Entry[capacity];
+	for (uint32_t j = 0; j < oldCapacity; j++)
+	{
+		if (!old[j].symbol)
+			continue;
+		uint32_t i = old[j].name->hash & (capacity - 1);
+		while (entries[i].symbol)
+			i = (i + 1) & (capacity - 1);
+		entries[i] = old[j];
+	}
+
+	if (old != inlineEntries)
+		delete[] old;
+}
+
+void Context::clear()
+{
+	if (entries != inlineEntries)
+		delete[] entries;
+	for (auto &it : inlineEntries)
+		it = Entry();
+	entries = inlineEntries;
+	capacity = INLINE_ENTRIES;
+	count = 0;
+}
+
+ArrayBuffer* Symbol::writableBuffer()
+{
+	if (!array)
+		array = heap.allocate<ArrayBuffer>();
+	else if (array->shared)
+	{
+		// someone else can see these cells, give us our own copy
+		array = array->copy();
+	}
+	return array;
+}
+
+ArrayBuffer* ArrayBuffer::copy() const
+{
+	ArrayBuffer* copy = heap.allocate<ArrayBuffer>();
+	// nobody writes a mapping, it can be shared as it is
+	if (packed)
+	{
+		copy->pack(mapping, packed, packedLength);
+		return copy;
+	}
+	copy->isSparse = isSparse;
+	copy->sparseLength = sparseLength;
+	copy->cells.reserve(cells.size());
+	forEach([copy](size_t index, Symbol* it) {
+		Symbol* cell = heap.allocateAs<Symbol>(MemStats::ARRAY);
+		*cell = *it;
+		cell->share();
+		if (copy->isSparse)
+			copy->sparseCells[index] = cell;
+		else
+			copy->cells.push_back(cell);
+	});
+	return copy;
+}
+
+Symbol*& ArrayBuffer::slot(size_t index)
+{
+	if (packed)
+		unpack();
+	if (!isSparse)
+	{
+		if (index < cells.size())
+			return cells[index];
+		// mostly gaps, keep only the cells there are
+		if (index >= SPARSE_MIN_LENGTH && (cells.size() + 1) * SPARSE_GAP_RATIO < index + 1)
+			makeSparse();
+		else
+		{
+			// a wild index must not take the host down with it
+			limits.reserve((index - cells.size()) * sizeof(Symbol));
+			metrics.add(Metrics::ARRAY_RESIZES);
+			while (cells.size() < index)
+				cells.push_back(heap.allocateAs<Symbol>(MemStats::ARRAY));
+			cells.push_back(NULL);
+			return cells.back();
+		}
+	}
+	if (index >= sparseLength)
+	{
+		sparseLength = index + 1;
+		metrics.add(Metrics::ARRAY_RESIZES);
+	}
+	return sparseCells[index];
+}
+
+Symbol* ArrayBuffer::cell(size_t index)
+{
+	Symbol* &found = slot(index);
+	Symbol* cell = found;
+	if (!cell)
+		cell = found = heap.allocateAs<Symbol>(MemStats::ARRAY);
+	// filled back in enough to be worth the gaps again
+	if (isSparse && sparseCells.size() * DENSE_FILL_RATIO >= sparseLength)
+		makeDense();
+	return cell;
+}
+
+void ArrayBuffer::set(size_t index, Symbol* cell)
+{
+	slot(index) = cell;
+	if (isSparse && sparseCells.size() * DENSE_FILL_RATIO >= sparseLength)
+		makeDense();
+}
+
+Array& ArrayBuffer::dense()
+{
+	if (packed)
+		unpack();
+	if (isSparse)
+		makeDense();
+	return cells;
+}
+
+void ArrayBuffer::pack(shared_ptr<const MappedFile> mapping, const int32_t* values, size_t count)
+{
+	this->mapping = mapping;
+	packed = values;
+	packedLength = count;
+}
+
+void ArrayBuffer::unpack()
+{
+	metrics.add(Metrics::ARRAY_RESIZES);
+	limits.reserve(packedLength * sizeof(Symbol));
+	cells.reserve(packedLength);
+	for (size_t i = 0; i < packedLength; i++)
+	{
+		Symbol* cell = heap.allocateAs<Symbol>(MemStats::ARRAY);
+		cell->type = Symbol::INTEGER;
+		cell->int_value = packed[i];
+		cell->assigned = true;
+		cells.push_back(cell);
+	}
+	packed = NULL;
+	packedLength = 0;
+	mapping.reset();
+}
+
+void ArrayBuffer::makeSparse()
+{
+	metrics.add(Metrics::ARRAY_RESIZES);
+	// cells never written are no different to no cell at all
+	for (size_t i = 0; i < cells.size(); i++)
+		if (cells[i]->assigned)
+			sparseCells[i] = cells[i];
+	sparseLength = cells.size();
+	Array().swap(cells);
+	isSparse = true;
 }
 
-void runProgram(list<Statement*>* program)
+void ArrayBuffer::makeDense()
+{
+	metrics.add(Metrics::ARRAY_RESIZES);
+	limits.reserve((sparseLength - sparseCells.size()) * sizeof(Symbol));
+	cells.reserve(sparseLength);
+	for (size_t i = 0; i < sparseLength; i++)
+	{
+		auto found = sparseCells.find(i);
+		cells.push_back(found == sparseCells.end() ? heap.allocateAs<Symbol>(MemStats::ARRAY) : found->second);
+	}
+	std::unordered_map<uint32_t, Symbol*>().swap(sparseCells);
+	sparseLength = 0;
+	isSparse = false;
+}
+
+void Limits::start()
+{
+	if (timeout)
+		deadline = milliseconds() + timeout;
+}
+
+void Limits::check()
+{
+	if (fuel && statementCount > fuel)
+		throw ScriptAbort(MS_ERROR::FUEL, currentLine);
+	if (heapQuota && heap.stats.liveBytes > heapQuota)
+	{
+		// live bytes count garbage until it is swept, see if
+		// the script really holds on to that much
+		heap.collect(true);
+		if (heap.stats.liveBytes > heapQuota)
+			throw ScriptAbort(MS_ERROR::MEMORY, currentLine);
+	}
+	// the clock is not free, only look at it now and then
+	if (deadline && ++polls % CLOCK_POLLS == 0 && milliseconds() > deadline)
+		throw ScriptAbort(MS_ERROR::TIMEOUT, currentLine);
+}
+
+/*
+ * We can't collect here, what is being built isn't rooted yet, so
+ * only what could never fit is refused. Going over the quota with
+ * garbage about is left to the collection at the next safepoint.
+ */
+void Limits::reserve(size_t bytes)
+{
+	if (heapQuota && bytes > heapQuota)
+		throw ScriptAbort(MS_ERROR::MEMORY, currentLine);
+}
+
+void safepoint()
+{
+	limits.check();
+	heap.safepoint();
+	memStats.poll(stderr);
+	pollMetrics();
+	profiler.poll();
+	// let other scripts on this thread have a turn
+	if (activeScheduler)
+		activeScheduler->poll();
+}
+
+bool runProgram(list<Statement*>* program)
 {
 	if (program == NULL)
-		return;
+		return false;
+
+	limits.start();
 
 	/* for each Statement in the program */
-	for (list<Statement*>::const_iterator it = program->begin(), end = program->end(); it != end; ++it)
+	try
 	{
-		try { (*it)->execute(globalContext); }
-		catch (Statement* s)
+		for (list<Statement*>::const_iterator it = program->begin(), end = program->end(); it != end; ++it)
 		{
-			// this happens when a break/continue are
-			// used outside of a container
-			fprintf(stderr, "Line %d, type violation\n", s->lineNumber);
+			// a loaded snapshot already did everything before here
+			if ((*it)->lineNumber < snapshot.resumeLine)
+				continue;
+			snapshot.poll((*it)->lineNumber);
+			// nothing but the globals are live between statements
+			safepoint();
+			tracer.counter("heap", heap.stats.liveBytes);
+			TraceScope traceScope("statement", (*it)->lineNumber);
+			PerfFrame perfFrame((*it)->lineNumber);
+			try { (*it)->run(globalContext); }
+			catch (Statement* s)
+			{
+				// this happens when a break/continue are
+				// used outside of a container
+				fprintf(scriptErr, "Line %d, type violation\n", s->lineNumber);
+			}
 		}
 	}
+	catch (ScriptAbort &abort)
+	{
+		// the script is over, whatever it was doing
+		bool errorReported = false;
+		MS_ERROR::report(errorReported, abort.type, abort.lineNumber);
+		return true;
+	}
+	return false;
 }
@@ -11,13 +11,20 @@
 #include <map>
 #include <list>
 #include <stack>
-#include <memory>
-
+#include <mutex>
 #include "ast.hh"
+#include "heap.hh"
+#include "profiler.hh"
+#include "perfcounters.hh"
+#include "tracer.hh"
+
+extern thread_local ContextPtr globalContext;
 
-extern ContextPtr globalContext;
+extern thread_local std::stack<Expression*> callStack;
 
-extern std::stack<Expression*> callStack;
+/* where document.write and errors go for the script on this thread */
+extern thread_local FILE* scriptOut;
+extern thread_local FILE* scriptErr;
 
 class MS_ERROR
 {
@@ -27,17 +34,79 @@ public:
 		VALUE,
 		PARAMETER,
 		CONDITION,
-		UNDECLARED
+		UNDECLARED,
+		FUEL,
+		TIMEOUT,
+		MEMORY
 	};
 
 	static void report(bool &errorReported, ERROR_TYPE type, int lineNumber, std::string varName = "");
 };
 
-std::shared_ptr<Symbol> getTableSymbol(ContextPtr context, std::string name);
+/*
+ * Thrown when a script runs past one of its limits. Every catch-all
+ * in the interpreter passes this on so it ends the whole run.
+ */
+class ScriptAbort
+{
+public:
+	MS_ERROR::ERROR_TYPE type;
+	int lineNumber;
+
+	ScriptAbort(MS_ERROR::ERROR_TYPE type, int lineNumber) : type(type), lineNumber(lineNumber) {}
+};
+
+/* per run limits, zero means unlimited */
+class Limits
+{
+	unsigned long polls = 0;
+	long deadline = 0;
+public:
+	unsigned long fuel = 0;        // statements
+	long timeout = 0;              // milliseconds of wall-clock time
+	size_t heapQuota = 0;          // live heap bytes
+
+	/* start the clock on a run */
+	void start();
+	/* called from safepoints */
+	void check();
+	/* check this much more could ever fit before we try */
+	void reserve(size_t bytes);
+};
+
+extern thread_local Limits limits;
+
+/* an empty global context, but for the builtins */
+ContextPtr newGlobalContext();
+
+Symbol* getTableSymbol(ContextPtr context, const Atom* name);
 
 // Assumes condition has been evaluated first
 bool getTruth(Expression* condition, bool &errorReported);
 
-void runProgram(std::list<Statement*>* program);
+// Writes out a value as document.write does
+void writeValue(const Symbol &value, bool &errorReported, int lineNumber);
+
+// Collect garbage, and whatever else needs a quiet moment;
+// called at loop back-edges, calls and between statements
+void safepoint();
+
+// Proves what types it can and marks those sites check-free,
+// optionally reporting proven errors and dynamic sites
+void inferTypes(std::list<Statement*>* program, bool report);
+// The same for a function body parsed after the rest
+void inferFunction(Function* function);
+
+// The parser and lexer are not reentrant, hold this to use them
+extern std::mutex parseLock;
+
+// Leave function bodies for their first call
+extern bool lazyFunctions;
+
+// Largest function body, in expression nodes, copied into its calls
+extern unsigned int inlineBudget;
+
+// Runs a parsed program, true if it was stopped for going past a limit
+bool runProgram(std::list<Statement*>* program);
 
 #endif // _RUNTIME_H
@@ -0,0 +1,220 @@
+/*
+ * CS352 Spring 2015
+ * Cooperative scheduler for miniscript
+ * Andrew F. Davis
+ */
+
+#include "scheduler.hh"
+
+#include <cstdio>
+#include <ctime>
+#include <stack>
+#include <vector>
+#include <utility>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "runtime.hh"
+#include "profiler.hh"
+
+using namespace std;
+
+thread_local Scheduler* activeScheduler = NULL;
+
+/* as big as a usual main thread stack, only what is touched is backed */
+static const size_t TASK_STACK = 8 << 20;
+static const size_t GUARD_PAGE = 4096;
+
+static long microseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * The per-thread runtime state of a task. Switching is swapping this
+ * with the thread's own, in and out again, so while a task is switched
+ * out it holds the task's state and while it runs it holds the state
+ * of whoever ran it.
+ */
+struct RuntimeState
+{
+	ContextPtr globals = NULL;
+	stack<Expression*> calls;
+	vector<Context*> frames;
+	FILE* out = stdout;
+	FILE* err = stderr;
+	int line = 0;
+	unsigned long statements = 0;
+	Limits limits;
+	int track = tracer.newTrack();
+	AtomScope* atoms = NULL;
+	Profiler::Stack profile;
+	uint64_t callDepth = 0;
+
+	void exchange()
+	{
+		swap(globals, globalContext);
+		swap(calls, callStack);
+		heap.swapFrames(frames);
+		swap(out, scriptOut);
+		swap(err, scriptErr);
+		swap(line, currentLine);
+		swap(statements, statementCount);
+		swap(limits, ::limits);
+		swap(track, Tracer::track);
+		swap(atoms, atomScope);
+		profiler.swapStack(profile);
+		uint64_t running = metrics.get(Metrics::CALL_DEPTH);
+		metrics.set(Metrics::CALL_DEPTH, callDepth);
+		callDepth = running;
+	}
+};
+
+/* a switched out task keeps what it references alive */
+class Scheduler::Task : public HeapRoot
+{
+public:
+	function<void()> body;
+	ucontext_t context;
+	char* stack = NULL;
+	bool finished = false;
+	int waitFd = -1;
+	short waitEvents = 0;
+	RuntimeState state;
+
+	void trace(Heap &heap)
+	{
+		heap.mark(state.globals);
+		for (auto &it : state.frames)
+			heap.mark(it);
+	}
+};
+
+Scheduler::~Scheduler()
+{
+	// tasks left over never get to finish
+	ready.insert(ready.end(), waiting.begin(), waiting.end());
+	for (auto &it : ready)
+	{
+		munmap(it->stack, TASK_STACK);
+		delete it;
+	}
+}
+
+void Scheduler::spawn(function<void()> body)
+{
+	Task* task = new Task;
+	task->body = body;
+	task->state.globals = newGlobalContext();
+
+	task->stack = (char*)mmap(NULL, TASK_STACK, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (task->stack == MAP_FAILED)
+	{
+		perror("mmap");
+		delete task;
+		return;
+	}
+	// running off the end faults instead of trampling memory
+	mprotect(task->stack, GUARD_PAGE, PROT_NONE);
+
+	getcontext(&task->context);
+	task->context.uc_stack.ss_sp = task->stack;
+	task->context.uc_stack.ss_size = TASK_STACK;
+	task->context.uc_link = &schedulerContext;
+	makecontext(&task->context, taskEntry, 0);
+
+	ready.push_back(task);
+}
+
+void Scheduler::taskEntry()
+{
+	Task* task = activeScheduler->current;
+	// nothing may unwind off the top of a task stack
+	try { task->body(); }
+	catch (...) {}
+	task->finished = true;
+	// returning goes on to uc_link, back in resume()
+}
+
+void Scheduler::resume(Task* task)
+{
+	current = task;
+	task->state.exchange();
+	activeScheduler = this;
+	sliceEnd = microseconds() + slice;
+	swapcontext(&schedulerContext, &task->context);
+	// a wait asked for too late is not the next task's
+	safepointFd = -1;
+	activeScheduler = NULL;
+	task->state.exchange();
+	current = NULL;
+}
+
+void Scheduler::wait(int fd, short events)
+{
+	safepointFd = -1;
+	current->waitFd = fd;
+	current->waitEvents = events;
+	swapcontext(&current->context, &schedulerContext);
+}
+
+void Scheduler::checkSlice()
+{
+	if (safepointFd >= 0)
+	{
+		int fd = safepointFd;
+		safepointFd = -1;
+		wait(fd, safepointEvents);
+	}
+	else if (microseconds() >= sliceEnd)
+		swapcontext(&current->context, &schedulerContext);
+}
+
+/* move the waiting tasks that can go on to the ready ones */
+void Scheduler::pollWaiting()
+{
+	vector<struct pollfd> fds;
+	for (auto &it : waiting)
+		fds.push_back({ it->waitFd, it->waitEvents, 0 });
+	// with nothing else to do, sleep on them a while
+	if (::poll(fds.data(), fds.size(), ready.empty() ? WAIT_POLL_MS : 0) <= 0)
+		return;
+
+	size_t kept = 0;
+	for (size_t i = 0; i < waiting.size(); i++)
+		if (fds[i].revents)
+		{
+			waiting[i]->waitFd = -1;
+			ready.push_back(waiting[i]);
+		}
+		else
+			waiting[kept++] = waiting[i];
+	waiting.resize(kept);
+}
+
+void Scheduler::runRound()
+{
+	if (!waiting.empty())
+		pollWaiting();
+
+	for (size_t count = ready.size(); count > 0; count--)
+	{
+		Task* task = ready.front();
+		ready.pop_front();
+		resume(task);
+		if (task->finished)
+		{
+			munmap(task->stack, TASK_STACK);
+			delete task;
+		}
+		else if (task->waitFd >= 0)
+			waiting.push_back(task);
+		else
+			ready.push_back(task);
+	}
+}
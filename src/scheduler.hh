@@ -0,0 +1,85 @@
+/*
+ * CS352 Spring 2015
+ * Cooperative scheduler for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <ucontext.h>
+
+/*
+ * Runs many scripts on one thread. Each task gets its own machine stack
+ * and its own copy of the per-thread runtime state. A task that has used
+ * up its time slice is switched out at the next safepoint, where the
+ * collector is safe to run and no exception is being handled. A task
+ * waiting on a file is left out of the rounds until it is ready.
+ */
+class Scheduler
+{
+public:
+	class Task;
+
+	/* microseconds a task runs before giving way */
+	long slice = 2000;
+
+	Scheduler() {}
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator=(const Scheduler&) = delete;
+	~Scheduler();
+
+	/* queue up a new task, it first runs in the next round */
+	void spawn(std::function<void()> body);
+	bool idle() const { return ready.empty() && waiting.empty(); }
+	/* give every ready task a slice, and those whose file is ready */
+	void runRound();
+
+	/*
+	 * Switch the running task out until fd is ready for these poll()
+	 * events. Only where a task may switch: outside the script, or
+	 * at a safepoint for which there is waitAtSafepoint().
+	 */
+	void wait(int fd, short events);
+	void waitAtSafepoint(int fd, short events)
+	{
+		safepointFd = fd;
+		safepointEvents = events;
+	}
+
+	/* called from safepoints by the running task */
+	void poll()
+	{
+		if (safepointFd >= 0 || ++polls % SLICE_POLLS == 0)
+			checkSlice();
+	}
+
+private:
+	/* safepoints between looking at the clock */
+	static const unsigned long SLICE_POLLS = 64;
+	/* longest we sleep on waiting tasks, so the caller can take on more */
+	static const int WAIT_POLL_MS = 10;
+
+	std::deque<Task*> ready;
+	std::vector<Task*> waiting;
+	Task* current = NULL;
+	int safepointFd = -1;
+	short safepointEvents = 0;
+	ucontext_t schedulerContext;
+	unsigned long polls = 0;
+	long sliceEnd = 0;
+
+	void resume(Task* task);
+	void checkSlice();
+	void pollWaiting();
+	static void taskEntry();
+};
+
+/* the scheduler running the task on this thread, if any */
+extern thread_local Scheduler* activeScheduler;
+
+#endif // _SCHEDULER_H
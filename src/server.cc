@@ -0,0 +1,338 @@
+/*
+ * CS352 Spring 2015
+ * Script server for miniscript
+ * Andrew F. Davis
+ */
+
+#include "server.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <map>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "scheduler.hh"
+#include "program.hh"
+
+using namespace std;
+
+bool serving = false;
+
+/* requests bigger than this are not going to be sensible */
+static const size_t MAX_REQUEST = 64 * 1024;
+/* output held for a client before its script waits for it */
+static const size_t MAX_BUFFERED = 64 * 1024;
+
+/* accepted connections waiting for a worker */
+static mutex queueLock;
+static condition_variable queueReady;
+static deque<int> pending;
+
+static Limits defaultLimits;
+static long sliceLength;
+/* the main thread's collector settings, for each worker's heap */
+static size_t heapThreshold;
+static double heapGrowth;
+static long heapPauseBudget;
+
+/*
+ * A client's socket. It is non-blocking so that a slow client only
+ * holds up its own script: reads wait in the scheduler, and frames
+ * are kept here until the socket takes them.
+ */
+struct Connection
+{
+	int fd;
+	std::string outgoing;
+	size_t sent = 0;
+	bool broken = false;  // the client went away, what it is sent is dropped
+
+	Connection(int fd) : fd(fd) {}
+
+	/* send what the socket will take now */
+	void flush()
+	{
+		while (!broken && sent < outgoing.size())
+		{
+			ssize_t written = write(fd, outgoing.data() + sent, outgoing.size() - sent);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					broken = true;
+				break;
+			}
+			sent += written;
+		}
+		if (broken || sent == outgoing.size())
+		{
+			outgoing.clear();
+			sent = 0;
+		}
+	}
+
+	/* send the lot, from outside the script where the task may wait */
+	void drain()
+	{
+		for (flush(); !outgoing.empty(); flush())
+			activeScheduler->wait(fd, POLLOUT);
+	}
+};
+
+static void sendFrame(Connection* connection, char type, const char* data, size_t length)
+{
+	char header[5];
+	uint32_t size = htonl(length);
+	header[0] = type;
+	memcpy(header + 1, &size, sizeof(size));
+	connection->outgoing.append(header, sizeof(header));
+	connection->outgoing.append(data, length);
+	connection->flush();
+	// a script outrunning its client waits at its next safepoint
+	if (connection->outgoing.size() - connection->sent > MAX_BUFFERED)
+		activeScheduler->waitAtSafepoint(connection->fd, POLLOUT);
+}
+
+/* a stdio stream whose writes go out as frames of one type */
+struct FrameStream
+{
+	Connection* connection;
+	char type;
+};
+
+static ssize_t frameStreamWrite(void* cookie, const char* data, size_t length)
+{
+	FrameStream* stream = (FrameStream*)cookie;
+	if (stream->connection->broken)
+		return -1;
+	sendFrame(stream->connection, stream->type, data, length);
+	return length;
+}
+
+static FILE* openFrameStream(FrameStream* stream)
+{
+	cookie_io_functions_t io;
+	memset(&io, 0, sizeof(io));
+	io.write = frameStreamWrite;
+	return fopencookie(stream, "w", io);
+}
+
+static bool readRequest(int fd, vector<string> &args)
+{
+	string request;
+	char buffer[4096];
+	for (;;)
+	{
+		// an empty string ends the request
+		size_t start = 0;
+		args.clear();
+		for (size_t end; (end = request.find('\0', start)) != string::npos; start = end + 1)
+		{
+			if (end == start)
+				return !args.empty();
+			args.push_back(request.substr(start, end - start));
+		}
+
+		if (request.size() > MAX_REQUEST)
+			return false;
+		ssize_t count = read(fd, buffer, sizeof(buffer));
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			activeScheduler->wait(fd, POLLIN);
+			continue;
+		}
+		if (count <= 0)
+			return false;
+		request.append(buffer, count);
+	}
+}
+
+static bool parseOption(const string &option, Limits &limits)
+{
+	const char* arg = option.c_str();
+	if (!strncmp(arg, "--max-steps=", 12))
+		limits.fuel = strtoul(arg + 12, NULL, 0);
+	else if (!strncmp(arg, "--timeout=", 10))
+		limits.timeout = strtol(arg + 10, NULL, 0);
+	else if (!strncmp(arg, "--max-heap=", 11))
+		limits.heapQuota = strtoul(arg + 11, NULL, 0);
+	else
+		return false;
+	return true;
+}
+
+static void runRequest(Connection* connection, const vector<string> &args)
+{
+	FrameStream outStream = { connection, 'o' };
+	FrameStream errStream = { connection, 'e' };
+	scriptOut = openFrameStream(&outStream);
+	scriptErr = openFrameStream(&errStream);
+	setvbuf(scriptErr, NULL, _IOLBF, BUFSIZ);
+
+	int status = 0;
+	Limits requested = defaultLimits;
+	for (size_t i = 1; i < args.size(); i++)
+		if (!parseOption(args[i], requested))
+		{
+			fprintf(scriptErr, "unknown option %s\n", args[i].c_str());
+			status = 1;
+		}
+
+	CachedProgram* cached = status ? NULL : checkoutProgram(args[0]);
+	if (cached)
+	{
+		startProgram(cached, requested);
+
+		try
+		{
+			if (runProgram(cached->program))
+				status = 1;
+		}
+		catch (Expression*) {} // a return at the top ends the script
+		catch (...)
+		{
+			// an error nothing in the script caught, it was reported
+			// where it happened and the script is over
+			status = 1;
+		}
+		checkinProgram(args[0], cached);
+	}
+	else
+		status = 1;
+
+	fclose(scriptOut);
+	fclose(scriptErr);
+	scriptOut = stdout;
+	scriptErr = stderr;
+
+	string code = to_string(status);
+	sendFrame(connection, 'x', code.data(), code.size());
+	connection->drain();
+}
+
+/*
+ * Each worker time-slices the runs it has taken on, picking up
+ * at most one new connection between rounds so the scripts it
+ * already has keep moving. It only sleeps when it has nothing,
+ * or briefly in the scheduler while all it has wait on clients.
+ */
+static void worker()
+{
+	heap.threshold = heapThreshold;
+	heap.growth = heapGrowth;
+	heap.pauseBudget = heapPauseBudget;
+
+	Scheduler scheduler;
+	scheduler.slice = sliceLength;
+	for (;;)
+	{
+		int fd = -1;
+		{
+			unique_lock<mutex> lock(queueLock);
+			if (scheduler.idle())
+				queueReady.wait(lock, [] { return !pending.empty(); });
+			if (!pending.empty())
+			{
+				fd = pending.front();
+				pending.pop_front();
+			}
+		}
+
+		if (fd >= 0)
+			scheduler.spawn([fd] {
+				Connection connection(fd);
+				vector<string> args;
+				if (readRequest(fd, args))
+					runRequest(&connection, args);
+				close(fd);
+			});
+		scheduler.runRound();
+	}
+}
+
+int serve(const char* socketPath, unsigned int workers, long slice, const Limits &defaults)
+{
+	serving = true;
+	defaultLimits = defaults;
+	sliceLength = slice;
+	heapThreshold = heap.threshold;
+	heapGrowth = heap.growth;
+	heapPauseBudget = heap.pauseBudget;
+	// clients that hang up early must not take us with them
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "socket path %s is too long\n", socketPath);
+		return 1;
+	}
+	strcpy(address.sun_path, socketPath);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+
+	// a socket left behind by an earlier server is in our way
+	struct stat st;
+	if (!stat(socketPath, &st) && S_ISSOCK(st.st_mode))
+		unlink(socketPath);
+
+	if (bind(listener, (struct sockaddr*)&address, sizeof(address)) || listen(listener, SOMAXCONN))
+	{
+		perror(socketPath);
+		close(listener);
+		return 1;
+	}
+
+	if (workers == 0)
+		workers = thread::hardware_concurrency() ? thread::hardware_concurrency() : 4;
+	for (unsigned int i = 0; i < workers; i++)
+		thread(worker).detach();
+
+	for (;;)
+	{
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			break;
+		}
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		{
+			lock_guard<mutex> lock(queueLock);
+			pending.push_back(fd);
+		}
+		queueReady.notify_one();
+	}
+
+	close(listener);
+	return 1;
+}
@@ -0,0 +1,30 @@
+/*
+ * CS352 Spring 2015
+ * Script server for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include "runtime.hh"
+
+/* set once we serve, parse errors must not end the process */
+extern bool serving;
+
+/*
+ * Listen on a Unix domain socket and run scripts for clients on a pool
+ * of worker threads. A request is the script path then any options,
+ * each NUL terminated, then an empty string. The reply is a series of
+ * frames (a type byte, a big endian 32 bit length, then the data):
+ * 'o' for document.write output, 'e' for errors and a final 'x' with
+ * the exit status in decimal.
+ *
+ * Every worker runs any number of scripts at once, switching between
+ * them at safepoints after each has had a slice of this many
+ * microseconds. A script whose client is slow to send or read only
+ * waits itself, the others on its worker carry on.
+ */
+int serve(const char* socketPath, unsigned int workers, long slice, const Limits &defaults);
+
+#endif // _SERVER_H
@@ -0,0 +1,522 @@
+/*
+ * CS352 Spring 2015
+ * Heap snapshots for miniscript
+ * Andrew F. Davis
+ */
+
+#include "snapshot.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "miniscript.hh"
+#include "ast.hh"
+#include "runtime.hh"
+#include "builtins.hh"
+
+using namespace std;
+
+Snapshot snapshot;
+
+/*
+ * The file is a header followed by flat tables of fixed size records,
+ * objects refer to each other by their index in these tables. Context
+ * zero is the global context. Strings (names, values and functions,
+ * which we find again by name) all live in one blob at the end.
+ */
+static const char SNAPSHOT_MAGIC[8] = { 'M', 'J', 'S', 'S', 'N', 'A', 'P', '3' };
+static const uint32_t NONE = 0xffffffff;
+
+struct SnapHeader
+{
+	char magic[8];
+	uint64_t sourceHash;
+	int32_t resumeLine;
+	uint32_t contexts;
+	uint32_t entries;
+	uint32_t symbols;
+	uint32_t arrays;
+	uint32_t cells;
+	uint32_t strings;
+	uint64_t blobSize;
+};
+
+struct SnapContext
+{
+	uint32_t firstEntry;
+	uint32_t entryCount;
+};
+
+struct SnapEntry
+{
+	uint32_t name;
+	uint32_t symbol;
+};
+
+struct SnapSymbol
+{
+	int32_t type;
+	int32_t int_value;
+	uint8_t declared;
+	uint8_t assigned;
+	uint8_t bool_value;
+	uint8_t pad;
+	uint32_t string;
+	uint32_t object;
+	uint32_t array;
+	uint32_t function;
+};
+
+struct SnapArray
+{
+	uint32_t firstCell;
+	uint32_t cellCount;
+	uint32_t length;
+	uint32_t shared;
+};
+
+/* sparse arrays only have some of their cells */
+struct SnapCell
+{
+	uint32_t index;
+	uint32_t symbol;
+};
+
+struct SnapString
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+/* numbers each object the first time we meet it */
+class SnapWriter
+{
+public:
+	map<Context*, uint32_t> contextIds;
+	map<Symbol*, uint32_t> symbolIds;
+	map<ArrayBuffer*, uint32_t> arrayIds;
+	vector<Context*> contextOrder;
+	vector<Symbol*> symbolOrder;     // NULL for a packed integer
+	vector<ArrayBuffer*> arrayOrder;
+	/* the values of packed integers, by symbol id */
+	map<uint32_t, int32_t> integers;
+
+	vector<SnapContext> contexts;
+	vector<SnapEntry> entries;
+	vector<SnapSymbol> symbols;
+	vector<SnapArray> arrays;
+	vector<SnapCell> cells;
+	vector<SnapString> strings;
+	string blob;
+
+	uint32_t addString(const string &value)
+	{
+		SnapString record = { (uint32_t)blob.size(), (uint32_t)value.size() };
+		blob += value;
+		strings.push_back(record);
+		return strings.size() - 1;
+	}
+
+	uint32_t addContext(Context* context)
+	{
+		if (!context)
+			return NONE;
+		auto found = contextIds.find(context);
+		if (found != contextIds.end())
+			return found->second;
+		uint32_t id = contextOrder.size();
+		contextIds[context] = id;
+		contextOrder.push_back(context);
+		return id;
+	}
+
+	uint32_t addSymbol(Symbol* symbol)
+	{
+		auto found = symbolIds.find(symbol);
+		if (found != symbolIds.end())
+			return found->second;
+		uint32_t id = symbolOrder.size();
+		symbolIds[symbol] = id;
+		symbolOrder.push_back(symbol);
+		return id;
+	}
+
+	/* a cell for an integer a packed array holds, as unpack() would make it */
+	uint32_t addInteger(int32_t value)
+	{
+		uint32_t id = symbolOrder.size();
+		integers[id] = value;
+		symbolOrder.push_back(NULL);
+		return id;
+	}
+
+	uint32_t addArray(ArrayBuffer* array)
+	{
+		if (!array)
+			return NONE;
+		auto found = arrayIds.find(array);
+		if (found != arrayIds.end())
+			return found->second;
+		uint32_t id = arrayOrder.size();
+		arrayIds[array] = id;
+		arrayOrder.push_back(array);
+		return id;
+	}
+
+	/* walk the graph breadth first until every table is filled in */
+	void collect(Context* root)
+	{
+		addContext(root);
+		size_t c = 0, s = 0, a = 0;
+		while (c < contextOrder.size() || s < symbolOrder.size() || a < arrayOrder.size())
+		{
+			for (; c < contextOrder.size(); c++)
+			{
+				SnapContext record = { (uint32_t)entries.size(), (uint32_t)contextOrder[c]->size() };
+				contexts.push_back(record);
+				for (auto &it : *contextOrder[c])
+				{
+					SnapEntry entry = { addString(it.name->text), addSymbol(it.symbol) };
+					entries.push_back(entry);
+				}
+			}
+			for (; s < symbolOrder.size(); s++)
+			{
+				Symbol* symbol = symbolOrder[s];
+				SnapSymbol record;
+				memset(&record, 0, sizeof(record));
+				if (!symbol)
+				{
+					record.type = Symbol::INTEGER;
+					record.int_value = integers[s];
+					record.assigned = true;
+					record.string = record.object = record.array = record.function = NONE;
+					symbols.push_back(record);
+					continue;
+				}
+				record.type = symbol->type;
+				record.int_value = symbol->int_value;
+				record.declared = symbol->declared;
+				record.assigned = symbol->assigned;
+				record.bool_value = symbol->bool_value;
+				record.string = symbol->string_value.empty() ? NONE : addString(symbol->string_value.str());
+				record.object = addContext(symbol->object);
+				record.array = addArray(symbol->array);
+				record.function = symbol->function ? addString(symbol->function->getName()) : NONE;
+				// builtins are found again by name too
+				if (symbol->type == Symbol::NATIVE)
+					record.function = addString(symbol->native->name->text);
+				symbols.push_back(record);
+			}
+			for (; a < arrayOrder.size(); a++)
+			{
+				ArrayBuffer* array = arrayOrder[a];
+				SnapArray record = { (uint32_t)cells.size(), 0, (uint32_t)array->size(), array->shared };
+				// a mapped file may be gone by the time we are restored,
+				// its integers are written out as the cells they'd make
+				// without the array being unpacked here
+				if (const int32_t* values = array->packedValues())
+				{
+					record.cellCount = array->size();
+					for (uint32_t i = 0; i < record.cellCount; i++)
+					{
+						SnapCell cell = { i, addInteger(values[i]) };
+						cells.push_back(cell);
+					}
+					arrays.push_back(record);
+					continue;
+				}
+				vector<pair<uint32_t, Symbol*>> present;
+				array->forEach([&present](size_t index, Symbol* cell) { present.push_back(make_pair(index, cell)); });
+				sort(present.begin(), present.end());
+				record.cellCount = present.size();
+				arrays.push_back(record);
+				for (auto &it : present)
+				{
+					SnapCell cell = { it.first, addSymbol(it.second) };
+					cells.push_back(cell);
+				}
+			}
+		}
+	}
+};
+
+static uint64_t hashBytes(const char* data, size_t length)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool hashFile(const char* path, uint64_t &hash)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	string source;
+	char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		source.append(buffer, count);
+	fclose(file);
+	hash = hashBytes(source.data(), source.size());
+	return true;
+}
+
+bool Snapshot::hashSource(const char* path)
+{
+	return hashFile(path, sourceHash);
+}
+
+template <class T>
+static bool writeTable(FILE* file, const vector<T> &table)
+{
+	return table.empty() || fwrite(table.data(), sizeof(T), table.size(), file) == table.size();
+}
+
+bool Snapshot::save(int lineNumber)
+{
+	SnapWriter writer;
+	writer.collect(globalContext);
+
+	SnapHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.sourceHash = sourceHash;
+	header.resumeLine = lineNumber;
+	header.contexts = writer.contexts.size();
+	header.entries = writer.entries.size();
+	header.symbols = writer.symbols.size();
+	header.arrays = writer.arrays.size();
+	header.cells = writer.cells.size();
+	header.strings = writer.strings.size();
+	header.blobSize = writer.blob.size();
+
+	FILE* file = fopen(savePath, "wb");
+	if (!file)
+	{
+		fprintf(stderr, "couldn't open %s for writing\n", savePath);
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		writeTable(file, writer.contexts) &&
+		writeTable(file, writer.entries) &&
+		writeTable(file, writer.symbols) &&
+		writeTable(file, writer.arrays) &&
+		writeTable(file, writer.cells) &&
+		writeTable(file, writer.strings) &&
+		fwrite(writer.blob.data(), 1, writer.blob.size(), file) == writer.blob.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok)
+		fprintf(stderr, "couldn't write snapshot %s\n", savePath);
+	return ok;
+}
+
+bool Snapshot::load(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "couldn't open snapshot %s\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(SnapHeader))
+	{
+		fprintf(stderr, "snapshot %s is truncated\n", path);
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		fprintf(stderr, "couldn't map snapshot %s\n", path);
+		return false;
+	}
+
+	const char* base = (const char*)mapping;
+	const SnapHeader* header = (const SnapHeader*)base;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)))
+	{
+		fprintf(stderr, "%s is not a snapshot\n", path);
+		munmap(mapping, size);
+		return false;
+	}
+	if (header->sourceHash != sourceHash)
+	{
+		fprintf(stderr, "snapshot %s was taken from a different script\n", path);
+		munmap(mapping, size);
+		return false;
+	}
+
+	// lay out the tables, making sure they all fit
+	size_t offset = sizeof(SnapHeader);
+	const SnapContext* contexts = (const SnapContext*)(base + offset);
+	offset += header->contexts * sizeof(SnapContext);
+	const SnapEntry* entries = (const SnapEntry*)(base + offset);
+	offset += header->entries * sizeof(SnapEntry);
+	const SnapSymbol* symbols = (const SnapSymbol*)(base + offset);
+	offset += header->symbols * sizeof(SnapSymbol);
+	const SnapArray* arrays = (const SnapArray*)(base + offset);
+	offset += header->arrays * sizeof(SnapArray);
+	const SnapCell* cells = (const SnapCell*)(base + offset);
+	offset += header->cells * sizeof(SnapCell);
+	const SnapString* strings = (const SnapString*)(base + offset);
+	offset += header->strings * sizeof(SnapString);
+	const char* blob = base + offset;
+	offset += header->blobSize;
+	if (offset != size || header->contexts == 0)
+	{
+		fprintf(stderr, "snapshot %s is truncated\n", path);
+		munmap(mapping, size);
+		return false;
+	}
+
+	auto getString = [&](uint32_t id) { return string(blob + strings[id].offset, strings[id].length); };
+
+	// functions come from parsing this same script, find them by name
+	map<string, Function*> functions;
+	for (auto &it : *globalContext)
+		if (it.symbol->type == Symbol::FUNCTION)
+			functions[it.symbol->function->getName()] = it.symbol->function;
+
+	// check every reference before we touch the heap
+	bool valid = true;
+	auto checkString = [&](uint32_t id) {
+		if (id >= header->strings || strings[id].offset + (uint64_t)strings[id].length > header->blobSize)
+			valid = false;
+	};
+	for (uint32_t i = 0; i < header->contexts; i++)
+		if (contexts[i].firstEntry + (uint64_t)contexts[i].entryCount > header->entries)
+			valid = false;
+	for (uint32_t i = 0; valid && i < header->entries; i++)
+	{
+		checkString(entries[i].name);
+		if (entries[i].symbol >= header->symbols)
+			valid = false;
+	}
+	for (uint32_t i = 0; valid && i < header->symbols; i++)
+	{
+		const SnapSymbol &record = symbols[i];
+		if (record.type < 0 || record.type > Symbol::UNDEFINED)
+			valid = false;
+		// these are used without looking for NULL
+		if ((record.type == Symbol::FUNCTION && record.function == NONE) ||
+			(record.type == Symbol::OBJECT && record.object == NONE) ||
+			(record.type == Symbol::ARRAY && record.array == NONE))
+			valid = false;
+		if (record.string != NONE)
+			checkString(record.string);
+		if (record.object != NONE && record.object >= header->contexts)
+			valid = false;
+		if (record.array != NONE && record.array >= header->arrays)
+			valid = false;
+		if (record.type == Symbol::NATIVE && record.function == NONE)
+			valid = false;
+		if (valid && record.function != NONE)
+		{
+			checkString(record.function);
+			if (valid && record.type == Symbol::NATIVE)
+			{
+				if (!findNative(getString(record.function)))
+					valid = false;
+			}
+			else if (valid && !functions.count(getString(record.function)))
+				valid = false;
+		}
+	}
+	for (uint32_t i = 0; i < header->arrays; i++)
+	{
+		if (arrays[i].firstCell + (uint64_t)arrays[i].cellCount > header->cells ||
+			arrays[i].length > (uint32_t)INT_MAX)
+		{
+			valid = false;
+			continue;
+		}
+		for (uint32_t c = 0; c < arrays[i].cellCount; c++)
+			if (cells[arrays[i].firstCell + c].index >= arrays[i].length)
+				valid = false;
+	}
+	for (uint32_t i = 0; i < header->cells; i++)
+		if (cells[i].symbol >= header->symbols)
+			valid = false;
+	if (!valid)
+	{
+		fprintf(stderr, "snapshot %s is corrupt\n", path);
+		munmap(mapping, size);
+		return false;
+	}
+
+	// make every object first, nothing collects until we return
+	vector<Context*> newContexts(header->contexts);
+	vector<Symbol*> newSymbols(header->symbols);
+	vector<ArrayBuffer*> newArrays(header->arrays);
+	globalContext->clear();
+	newContexts[0] = globalContext;
+	for (uint32_t i = 1; i < header->contexts; i++)
+		newContexts[i] = heap.allocate<Context>();
+	for (uint32_t i = 0; i < header->symbols; i++)
+		newSymbols[i] = heap.allocate<Symbol>();
+	for (uint32_t i = 0; i < header->arrays; i++)
+		newArrays[i] = heap.allocate<ArrayBuffer>();
+
+	// then fill them in
+	for (uint32_t i = 0; i < header->contexts; i++)
+		for (uint32_t e = 0; e < contexts[i].entryCount; e++)
+		{
+			const SnapEntry &entry = entries[contexts[i].firstEntry + e];
+			newContexts[i]->insert(intern(getString(entry.name)), newSymbols[entry.symbol]);
+		}
+	for (uint32_t i = 0; i < header->symbols; i++)
+	{
+		const SnapSymbol &record = symbols[i];
+		Symbol* symbol = newSymbols[i];
+		symbol->type = (Symbol::Type)record.type;
+		symbol->int_value = record.int_value;
+		symbol->declared = record.declared;
+		symbol->assigned = record.assigned;
+		symbol->bool_value = record.bool_value;
+		if (record.string != NONE)
+			symbol->string_value = String(getString(record.string));
+		if (record.object != NONE)
+			symbol->object = newContexts[record.object];
+		if (record.array != NONE)
+			symbol->array = newArrays[record.array];
+		if (record.function != NONE && symbol->type == Symbol::NATIVE)
+			symbol->native = findNative(getString(record.function));
+		else if (record.function != NONE)
+			symbol->function = functions[getString(record.function)];
+	}
+	for (uint32_t i = 0; i < header->arrays; i++)
+	{
+		newArrays[i]->shared = arrays[i].shared;
+		for (uint32_t c = 0; c < arrays[i].cellCount; c++)
+		{
+			const SnapCell &cell = cells[arrays[i].firstCell + c];
+			newArrays[i]->set(cell.index, newSymbols[cell.symbol]);
+		}
+		// gaps at the end still count
+		if (newArrays[i]->size() < arrays[i].length)
+			newArrays[i]->cell(arrays[i].length - 1);
+	}
+
+	resumeLine = header->resumeLine;
+	munmap(mapping, size);
+	return true;
+}
@@ -0,0 +1,54 @@
+/*
+ * CS352 Spring 2015
+ * Heap snapshots for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Saves everything reachable from the global context once a script
+ * reaches a top-level statement at or past a marker line, so a later
+ * run of the same script can load it and start from that statement.
+ */
+class Snapshot
+{
+public:
+	/* where and when to save, NULL for never */
+	const char* savePath = NULL;
+	int saveLine = 0;
+
+	/* line a loaded snapshot resumes at, 0 when we start fresh */
+	int resumeLine = 0;
+
+	/* identifies the script, snapshots only load into the same one */
+	bool hashSource(const char* path);
+
+	/* called by runProgram() before each top-level statement */
+	void poll(int lineNumber)
+	{
+		if (savePath && lineNumber >= saveLine)
+		{
+			save(lineNumber);
+			savePath = NULL;
+		}
+	}
+
+	bool save(int lineNumber);
+	/* replaces the global context, call after parsing */
+	bool load(const char* path);
+
+private:
+	uint64_t sourceHash = 0;
+};
+
+extern Snapshot snapshot;
+
+/* hash of a file's contents, to tell if something was made from it */
+bool hashFile(const char* path, uint64_t &hash);
+
+#endif // _SNAPSHOT_H
@@ -0,0 +1,147 @@
+/*
+ * CS352 Spring 2015
+ * Trace-event recorder for miniscript
+ * Andrew F. Davis
+ */
+
+#include "tracer.hh"
+
+#include <ctime>
+#include <chrono>
+#include <unistd.h>
+
+using namespace std;
+
+Tracer tracer;
+
+thread_local Tracer::Ring* Tracer::ring = NULL;
+thread_local int Tracer::track = 0;
+
+/* how often the writer drains the rings */
+static const chrono::milliseconds WRITE_PERIOD(10);
+
+static uint64_t nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool Tracer::start(const char* path)
+{
+	out = fopen(path, "w");
+	if (!out)
+		return false;
+	fprintf(out, "[\n");
+	epoch = nanoseconds();
+	enabled = true;
+	writer = thread(&Tracer::writeLoop, this);
+	return true;
+}
+
+void Tracer::stop()
+{
+	if (!out)
+		return;
+	enabled = false;
+	{
+		lock_guard<mutex> lock(writerLock);
+		stopping = true;
+	}
+	writerWake.notify_one();
+	writer.join();
+
+	// everyone has stopped recording, pick up the rest
+	drain();
+	fprintf(out, "\n]\n");
+	fclose(out);
+	out = NULL;
+}
+
+Tracer::Ring* Tracer::addRing()
+{
+	Ring* newRing = new Ring;
+	newRing->track = newTrack();
+	lock_guard<mutex> lock(ringsLock);
+	rings.push_back(newRing);
+	return newRing;
+}
+
+void Tracer::record(char phase, const char* name, long value)
+{
+	if (!ring)
+		ring = addRing();
+
+	size_t head = ring->head.load(memory_order_relaxed);
+	if (head - ring->tail.load(memory_order_acquire) >= RING_SIZE)
+	{
+		// the writer has fallen behind, never wait for it
+		ring->overflow.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	Event &event = ring->events[head % RING_SIZE];
+	event.phase = phase;
+	event.track = track ? track : ring->track;
+	event.name = name;
+	event.value = value;
+	event.time = nanoseconds();
+	ring->head.store(head + 1, memory_order_release);
+}
+
+void Tracer::drain()
+{
+	int pid = getpid();
+	unsigned long lost = 0;
+
+	lock_guard<mutex> lock(ringsLock);
+	for (auto &it : rings)
+	{
+		size_t head = it->head.load(memory_order_acquire);
+		size_t tail = it->tail.load(memory_order_relaxed);
+		for (; tail != head; tail++)
+		{
+			const Event &event = it->events[tail % RING_SIZE];
+			double ts = (event.time - epoch) / 1000.0;
+			fprintf(out, first ? "" : ",\n");
+			first = false;
+			// names are identifiers or our own literals, nothing to escape
+			switch (event.phase)
+			{
+			case 'B':
+				fprintf(out, "{\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+					event.name, pid, event.track, ts);
+				if (event.value)
+					fprintf(out, ",\"args\":{\"line\":%ld}", event.value);
+				fprintf(out, "}");
+				break;
+			case 'E':
+				fprintf(out, "{\"ph\":\"E\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+					pid, event.track, ts);
+				break;
+			case 'C':
+				// one series per thread or task, they each have a heap
+				fprintf(out, "{\"name\":\"%s\",\"ph\":\"C\",\"id\":%d,\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{\"bytes\":%ld}}",
+					event.name, event.track, pid, event.track, ts, event.value);
+				break;
+			}
+			written++;
+		}
+		it->tail.store(tail, memory_order_release);
+		lost += it->overflow.load(memory_order_relaxed);
+	}
+	dropped = lost;
+	fflush(out);
+}
+
+void Tracer::writeLoop()
+{
+	unique_lock<mutex> lock(writerLock);
+	while (!stopping)
+	{
+		writerWake.wait_for(lock, WRITE_PERIOD);
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+}
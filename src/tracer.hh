@@ -0,0 +1,103 @@
+/*
+ * CS352 Spring 2015
+ * Trace-event recorder for miniscript
+ * Andrew F. Davis
+ */
+
+#ifndef _TRACER_H
+#define _TRACER_H
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+
+/*
+ * Writes a timeline of the run as Chrome trace-event JSON, for
+ * chrome://tracing or Perfetto. The array format is used as the viewers
+ * accept it without its closing bracket, a server killed mid-run still
+ * leaves a readable trace. Each thread records into its own ring
+ * buffer with no locking; a writer thread drains them all to the file
+ * now and then. Events that find their ring full are dropped. Every
+ * name must outlive the run (literals and atoms).
+ */
+class Tracer
+{
+public:
+	static const size_t RING_SIZE = 1 << 16;
+
+	/* checked before recording anything, off unless started; written
+	 * by the main thread and read by every thread that records */
+	std::atomic<bool> enabled{false};
+
+	bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+	bool start(const char* path);
+	/* drain what is left and finish the file */
+	void stop();
+
+	void begin(const char* name, int lineNumber = 0) { if (isEnabled()) record('B', name, lineNumber); }
+	void end(const char* name) { if (isEnabled()) record('E', name, 0); }
+	void counter(const char* name, long value) { if (isEnabled()) record('C', name, value); }
+
+	/* a new timeline for a scheduler task, swapped in while it runs */
+	int newTrack() { return nextTrack++; }
+	static thread_local int track;
+
+	unsigned long written = 0;
+	unsigned long dropped = 0;
+
+private:
+	struct Event {
+		char phase;
+		int track;
+		const char* name;
+		long value;        // line for spans, value for counters
+		uint64_t time;     // nanoseconds
+	};
+
+	/* written only by its thread at head, read only by the writer at tail */
+	struct Ring {
+		int track;
+		Event events[RING_SIZE];
+		std::atomic<size_t> head{0};
+		std::atomic<size_t> tail{0};
+		std::atomic<unsigned long> overflow{0};
+	};
+
+	static thread_local Ring* ring;
+
+	FILE* out = NULL;
+	bool first = true;
+	uint64_t epoch = 0;
+	std::atomic<int> nextTrack{1};
+
+	std::mutex ringsLock;
+	std::vector<Ring*> rings;
+
+	std::thread writer;
+	std::mutex writerLock;
+	std::condition_variable writerWake;
+	bool stopping = false;
+
+	void record(char phase, const char* name, long value);
+	Ring* addRing();
+	void drain();
+	void writeLoop();
+};
+
+extern Tracer tracer;
+
+/* a span covering the life of this guard */
+class TraceScope
+{
+	const char* name;
+public:
+	TraceScope(const char* name, int lineNumber = 0) : name(name) { tracer.begin(name, lineNumber); }
+	~TraceScope() { tracer.end(name); }
+};
+
+#endif // _TRACER_H